@@ -6,6 +6,7 @@
 */
 #pragma once
 
+#include <cstddef>
 #include <vector>
 
 namespace k_tree
@@ -18,11 +19,14 @@ namespace k_tree
 	class allocator
 		{
 		private:
+			static constexpr size_t alignment = alignof(std::max_align_t);		// the alignment of every block returned by malloc()
 			std::vector<uint8_t *> blocks;				// a list of the block we have allocated
 			uint8_t *chunk;									// the current chunk we are allocating from
 			size_t size;										// the size of the current block (in bytes)
 			size_t used;										// the number of bytes of the current block that we have used
 			bool use_global_malloc;							// should we use the C/C++ runtime malloc method?
+			size_t bytes_allocated;							// the total number of bytes handed out by malloc()
+			size_t blocks_allocated;						// the number of blocks taken from the C/C++ runtime
 
 		public:
 			/*
@@ -33,7 +37,10 @@ namespace k_tree
 			allocator(size_t block_size = 1'073'741'824 /* 1GB */, bool use_global_malloc = false) :
 				chunk(nullptr),
 				size(block_size),
-				used(block_size)
+				used(block_size),
+				use_global_malloc(use_global_malloc),
+				bytes_allocated(0),
+				blocks_allocated(0)
 				{
 				/* Nothing */
 				}
@@ -52,18 +59,25 @@ namespace k_tree
 			/*
 				ALLOCATOR::MALLOC()
 				-------------------
-				Allocate a block of memory and return it to the caller
+				Allocate a block of memory and return it to the caller.  Every request is rounded up to a multiple of alignment so
+				that each block handed out is suitably aligned for any type, whatever the sizes of the requests before it
 			*/
 			void *malloc(size_t bytes)
 				{
+				bytes = (bytes + alignment - 1) & ~(alignment - 1);
+				bytes_allocated += bytes;
 				if (use_global_malloc)
+					{
+					blocks_allocated++;
 					return (void *)new uint8_t [bytes];
+					}
 				else
 					{
 					if (used + bytes > size)
 						{
 						chunk = new uint8_t[size];
 						blocks.push_back(chunk);
+						blocks_allocated++;
 						used = 0;
 						}
 
@@ -72,5 +86,25 @@ namespace k_tree
 					return start;
 					}
 				}
+
+			/*
+				ALLOCATOR::BYTES_USED()
+				-----------------------
+				Return the total number of bytes allocated through malloc()
+			*/
+			size_t bytes_used(void) const
+				{
+				return bytes_allocated;
+				}
+
+			/*
+				ALLOCATOR::BLOCKS_USED()
+				------------------------
+				Return the number of blocks allocated from the C/C++ runtime
+			*/
+			size_t blocks_used(void) const
+				{
+				return blocks_allocated;
+				}
 		};
 	}
@@ -0,0 +1,373 @@
+/*
+	ANALYSIS.CPP
+	------------
+	Copyright (c) 2020 Andrew Trotman
+	Released under the 2-clause BSD license (See:https://en.wikipedia.org/wiki/BSD_licenses)
+*/
+#include <math.h>
+
+#include <limits>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+#include "node.h"
+#include "analysis.h"
+
+namespace k_tree
+	{
+	/*
+		ANALYSIS::LEVEL::LEVEL()
+		------------------------
+	*/
+	analysis::level::level() :
+		nodes(0),
+		children(0),
+		min_fanout(std::numeric_limits<size_t>::max()),
+		max_fanout(0),
+		fanout_histogram(),
+		fill(0),
+		sum_squared_error(0),
+		drift(0),
+		max_drift(0)
+		{
+		/* Nothing */
+		}
+
+	/*
+		ANALYSIS::LEVEL::OPERATOR+=()
+		-----------------------------
+		Merge the statistics of the parameter into this
+	*/
+	analysis::level &analysis::level::operator+=(const level &with)
+		{
+		nodes += with.nodes;
+		children += with.children;
+		min_fanout = std::min(min_fanout, with.min_fanout);
+		max_fanout = std::max(max_fanout, with.max_fanout);
+		for (size_t bucket = 0; bucket < fanout_buckets; bucket++)
+			fanout_histogram[bucket] += with.fanout_histogram[bucket];
+		fill += with.fill;
+		sum_squared_error += with.sum_squared_error;
+		drift += with.drift;
+		max_drift = std::max(max_drift, with.max_drift);
+
+		return *this;
+		}
+
+	/*
+		ANALYSIS::ANALYSIS()
+		--------------------
+		Constructor
+	*/
+	analysis::analysis() :
+		depth(0),
+		vectors(0),
+		nodes(0),
+		count_mismatches(0)
+		{
+		/* Nothing */
+		}
+
+	/*
+		ANALYSIS::ACCOUNT_FOR_NODE()
+		----------------------------
+		Add the shape statistics and centroid drift of current (whose exact mean is sum / count) to the statistics for its level
+	*/
+	void analysis::account_for_node(const node *current, size_t depth_of_current, const std::vector<double> &sum, size_t count)
+		{
+		level &stats = levels[depth_of_current];
+
+		nodes++;
+		stats.nodes++;
+		stats.children += current->children;
+		stats.min_fanout = std::min(stats.min_fanout, current->children);
+		stats.max_fanout = std::max(stats.max_fanout, current->children);
+		stats.fill += (double)current->children / current->max_children;
+		stats.fanout_histogram[std::min(current->children * fanout_buckets / current->max_children, fanout_buckets - 1)]++;
+
+		if (count != current->leaves_below_this_point)
+			count_mismatches++;
+
+		double distance = 0;
+		if (count != 0)
+			for (size_t dimension = 0; dimension < sum.size(); dimension++)
+				{
+				double difference = current->centroid->vector[dimension] - sum[dimension] / count;
+				distance += difference * difference;
+				}
+		distance = sqrt(distance);
+
+		stats.drift += distance;
+		stats.max_drift = std::max(stats.max_drift, distance);
+		}
+
+	/*
+		ANALYSIS::ANALYSE_SUBTREE()
+		---------------------------
+		Recursively analyse the subtree rooted at current (which is depth levels below the root) into this.  path is the list
+		of nodes from the root down to (but not including) current.  The sum of the vectors below current is added to sum and the
+		number of vectors below current is returned.
+	*/
+	size_t analysis::analyse_subtree(const node *current, size_t depth_of_current, std::vector<const node *> &path, std::vector<double> &sum)
+		{
+		std::vector<double> own_sum(sum.size(), 0.0);
+		size_t count = 0;
+
+		path.push_back(current);
+		for (size_t which = 0; which < current->children; which++)
+			{
+			const node *child = current->child[which];
+			if (child->isleaf())
+				{
+				/*
+					A vector (or a micro-cluster of them), so account for its distance (and scatter) to each centroid above it and add it to the
+					exact mean
+				*/
+				double weight = (double)child->leaves_below_this_point;
+				for (size_t ancestor = 0; ancestor < path.size(); ancestor++)
+					levels[ancestor].sum_squared_error += weight * child->centroid->distance_squared(path[ancestor]->centroid) + child->scatter;
+
+				for (size_t dimension = 0; dimension < own_sum.size(); dimension++)
+					own_sum[dimension] += weight * child->centroid->vector[dimension];
+
+				count += child->leaves_below_this_point;
+				vectors += child->leaves_below_this_point;
+				}
+			else
+				count += analyse_subtree(child, depth_of_current + 1, path, own_sum);
+			}
+		path.pop_back();
+
+		account_for_node(current, depth_of_current, own_sum, count);
+
+		for (size_t dimension = 0; dimension < sum.size(); dimension++)
+			sum[dimension] += own_sum[dimension];
+
+		return count;
+		}
+
+	/*
+		ANALYSIS::ANALYSE()
+		-------------------
+		Analyse the tree rooted at root using the given number of threads (0 means one per CPU core).
+	*/
+	void analysis::analyse(const node *root, size_t dimensions, size_t threads)
+		{
+		/*
+			A piece of work for one thread: analyse a subtree
+		*/
+		struct task
+			{
+			const node *subtree;								// the root of the subtree
+			std::vector<const node *> path;				// the nodes from the root of the tree down to the subtree
+			analysis result;									// the analysis of the subtree
+			std::vector<double> sum;						// the sum of the vectors in the subtree
+			size_t count;										// the number of vectors in the subtree
+			};
+
+		*this = analysis();
+		if (root == nullptr)
+			return;
+
+		if (threads == 0)
+			threads = std::max(std::thread::hardware_concurrency(), 1U);
+
+		for (const node *current = root; !current->isleaf(); current = current->child[0])
+			depth++;
+		levels.assign(depth, level());
+
+		/*
+			Walk down the tree until there are enough subtrees to keep all the threads busy
+		*/
+		std::vector<const node *> frontier = {root};
+		std::vector<std::vector<const node *>> paths = {{}};
+		size_t frontier_depth = 0;
+		while (frontier.size() < 4 * threads && frontier_depth + 1 < depth)
+			{
+			std::vector<const node *> next_frontier;
+			std::vector<std::vector<const node *>> next_paths;
+			for (size_t which = 0; which < frontier.size(); which++)
+				for (size_t child = 0; child < frontier[which]->children; child++)
+					{
+					next_frontier.push_back(frontier[which]->child[child]);
+					next_paths.push_back(paths[which]);
+					next_paths.back().push_back(frontier[which]);
+					}
+			frontier.swap(next_frontier);
+			paths.swap(next_paths);
+			frontier_depth++;
+			}
+
+		/*
+			Analyse each subtree in parallel
+		*/
+		std::vector<task> tasks(frontier.size());
+		for (size_t which = 0; which < frontier.size(); which++)
+			{
+			tasks[which].subtree = frontier[which];
+			tasks[which].path = paths[which];
+			tasks[which].result.depth = depth;
+			tasks[which].result.levels.assign(depth, level());
+			tasks[which].sum.assign(dimensions, 0.0);
+			}
+
+		std::atomic<size_t> next_task(0);
+		auto worker = [&tasks, &next_task, frontier_depth]()
+			{
+			size_t which;
+			while ((which = next_task++) < tasks.size())
+				tasks[which].count = tasks[which].result.analyse_subtree(tasks[which].subtree, frontier_depth, tasks[which].path, tasks[which].sum);
+			};
+
+		std::vector<std::thread> pool;
+		for (size_t thread = 1; thread < std::min(threads, tasks.size()); thread++)
+			pool.push_back(std::thread(worker));
+		worker();
+		for (auto &thread : pool)
+			thread.join();
+
+		/*
+			Merge the results
+		*/
+		std::unordered_map<const node *, const task *> task_of;
+		for (const auto &current : tasks)
+			{
+			vectors += current.result.vectors;
+			nodes += current.result.nodes;
+			count_mismatches += current.result.count_mismatches;
+			for (size_t which = 0; which < depth; which++)
+				levels[which] += current.result.levels[which];
+			task_of[current.subtree] = &current;
+			}
+
+		/*
+			Account for the nodes above the subtrees (their sum squared errors were computed in the subtrees as the subtrees know their paths)
+		*/
+		std::vector<double> sum(dimensions, 0.0);
+		std::function<size_t(const node *, size_t, std::vector<double> &)> analyse_upper = [&](const node *current, size_t depth_of_current, std::vector<double> &into) -> size_t
+			{
+			if (depth_of_current == frontier_depth)
+				{
+				const task *subtree = task_of[current];
+				for (size_t dimension = 0; dimension < dimensions; dimension++)
+					into[dimension] += subtree->sum[dimension];
+				return subtree->count;
+				}
+
+			std::vector<double> own_sum(dimensions, 0.0);
+			size_t count = 0;
+			for (size_t which = 0; which < current->children; which++)
+				count += analyse_upper(current->child[which], depth_of_current + 1, own_sum);
+
+			account_for_node(current, depth_of_current, own_sum, count);
+			for (size_t dimension = 0; dimension < dimensions; dimension++)
+				into[dimension] += own_sum[dimension];
+
+			return count;
+			};
+		analyse_upper(root, 0, sum);
+
+		/*
+			Number the levels from the bottom
+		*/
+		std::reverse(levels.begin(), levels.end());
+		}
+
+	/*
+		ANALYSIS::LEAF_FILL_FACTOR()
+		----------------------------
+		Return the mean of children / max_children over the nodes directly above the vectors
+	*/
+	double analysis::leaf_fill_factor(void) const
+		{
+		return levels.size() == 0 || levels[0].nodes == 0 ? 0.0 : levels[0].fill / levels[0].nodes;
+		}
+
+	/*
+		ANALYSIS::DISTORTION()
+		----------------------
+		Return the sum of the squared distances of each vector to the centroid directly above it (the quantisation error)
+	*/
+	double analysis::distortion(void) const
+		{
+		return levels.size() == 0 ? 0.0 : levels[0].sum_squared_error;
+		}
+
+	/*
+		ANALYSIS::SUM_SQUARED_ERROR()
+		-----------------------------
+		Return the sum of squared errors over all levels
+	*/
+	double analysis::sum_squared_error(void) const
+		{
+		double total = 0;
+		for (const auto &current : levels)
+			total += current.sum_squared_error;
+		return total;
+		}
+
+	/*
+		ANALYSIS::TEXT_RENDER()
+		-----------------------
+		Serialise the analysis in a human-readable format down the given stream
+	*/
+	void analysis::text_render(std::ostream &stream) const
+		{
+		stream << "depth             : " << depth << "\n";
+		stream << "vectors           : " << vectors << "\n";
+		stream << "nodes             : " << nodes << "\n";
+		stream << "count mismatches  : " << count_mismatches << "\n";
+		stream << "leaf fill factor  : " << leaf_fill_factor() << "\n";
+		stream << "distortion        : " << distortion() << " (" << (vectors == 0 ? 0.0 : distortion() / vectors) << " per vector)\n";
+		stream << "sum squared error : " << sum_squared_error() << "\n";
+		stream << "level nodes min-fanout mean-fanout max-fanout fill sum-squared-error mean-drift max-drift fanout-histogram(10% bands)\n";
+		for (size_t which = 0; which < levels.size(); which++)
+			{
+			const level &current = levels[which];
+			stream << which << ' ' << current.nodes << ' ' << current.min_fanout << ' ' << (double)current.children / current.nodes << ' ' << current.max_fanout << ' ';
+			stream << current.fill / current.nodes << ' ' << current.sum_squared_error << ' ' << current.drift / current.nodes << ' ' << current.max_drift;
+			for (size_t bucket = 0; bucket < fanout_buckets; bucket++)
+				stream << (bucket == 0 ? " [" : " ") << current.fanout_histogram[bucket];
+			stream << "]\n";
+			}
+		}
+
+	/*
+		ANALYSIS::JSON_RENDER()
+		-----------------------
+		Serialise the analysis as a JSON object down the given stream
+	*/
+	void analysis::json_render(std::ostream &stream) const
+		{
+		stream << "{";
+		stream << "\"depth\":" << depth;
+		stream << ",\"vectors\":" << vectors;
+		stream << ",\"nodes\":" << nodes;
+		stream << ",\"count_mismatches\":" << count_mismatches;
+		stream << ",\"leaf_fill_factor\":" << leaf_fill_factor();
+		stream << ",\"distortion\":" << distortion();
+		stream << ",\"sum_squared_error\":" << sum_squared_error();
+		stream << ",\"levels\":[";
+		for (size_t which = 0; which < levels.size(); which++)
+			{
+			const level &current = levels[which];
+			stream << (which == 0 ? "" : ",") << "{";
+			stream << "\"nodes\":" << current.nodes;
+			stream << ",\"children\":" << current.children;
+			stream << ",\"min_fanout\":" << current.min_fanout;
+			stream << ",\"max_fanout\":" << current.max_fanout;
+			stream << ",\"fill_factor\":" << current.fill / current.nodes;
+			stream << ",\"sum_squared_error\":" << current.sum_squared_error;
+			stream << ",\"mean_drift\":" << current.drift / current.nodes;
+			stream << ",\"max_drift\":" << current.max_drift;
+			stream << ",\"fanout_histogram\":[";
+			for (size_t bucket = 0; bucket < fanout_buckets; bucket++)
+				stream << (bucket == 0 ? "" : ",") << current.fanout_histogram[bucket];
+			stream << "]}";
+			}
+		stream << "]}";
+		}
+	}
@@ -0,0 +1,142 @@
+/*
+	ANALYSIS.H
+	----------
+	Copyright (c) 2020 Andrew Trotman
+	Released under the 2-clause BSD license (See:https://en.wikipedia.org/wiki/BSD_licenses)
+*/
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+#include <iostream>
+
+namespace k_tree
+	{
+	class node;
+
+	/*
+		CLASS ANALYSIS
+		--------------
+		The shape and the quality of a tree.  Levels are numbered from the bottom, level 0 is the level directly above the vectors
+		and level depth-1 is the root.
+	*/
+	class analysis
+		{
+		public:
+			static constexpr size_t fanout_buckets = 10;				// the fan-out histogram has one bucket for each 10% of max_children
+
+			/*
+				CLASS ANALYSIS::LEVEL
+				---------------------
+				The statistics for one level of the tree
+			*/
+			class level
+				{
+				public:
+					size_t nodes;										// the number of nodes at this level
+					size_t children;									// the number of children of the nodes at this level
+					size_t min_fanout;								// the fewest children of any node at this level
+					size_t max_fanout;								// the most children of any node at this level
+					size_t fanout_histogram[fanout_buckets];	// the number of nodes with children / max_children in each 10% band (100% is in the last)
+					double fill;										// the sum of children / max_children (divide by nodes for the fill factor)
+					double sum_squared_error;						// the sum, over the vectors below this level, of the squared distance to their centroid at this level
+					double drift;										// the sum of the distances from each stored centroid to the exact mean of the vectors below it
+					double max_drift;									// the largest distance from any stored centroid to the exact mean of the vectors below it
+
+				public:
+					level();
+
+					/*
+						ANALYSIS::LEVEL::OPERATOR+=()
+						-----------------------------
+						Merge the statistics of the parameter into this
+					*/
+					level &operator+=(const level &with);
+				};
+
+		public:
+			size_t depth;						// the number of levels of nodes (not counting the vectors)
+			size_t vectors;					// the number of vectors in the tree
+			size_t nodes;						// the number of nodes in the tree (not counting the vectors)
+			size_t count_mismatches;		// the number of nodes whose leaves_below_this_point is not the number of vectors below it
+			std::vector<level> levels;		// the statistics for each level, levels[0] is directly above the vectors
+
+		private:
+			/*
+				ANALYSIS::ANALYSE_SUBTREE()
+				---------------------------
+				Recursively analyse the subtree rooted at current (which is depth levels below the root) into this.  path is the list
+				of nodes from the root down to (but not including) current.  The sum of the vectors below current is added to sum and the
+				number of vectors below current is returned.
+			*/
+			size_t analyse_subtree(const node *current, size_t depth_of_current, std::vector<const node *> &path, std::vector<double> &sum);
+
+			/*
+				ANALYSIS::ACCOUNT_FOR_NODE()
+				----------------------------
+				Add the shape statistics and centroid drift of current (whose exact mean is sum / count) to the statistics for its level
+			*/
+			void account_for_node(const node *current, size_t depth_of_current, const std::vector<double> &sum, size_t count);
+
+		public:
+			/*
+				ANALYSIS::ANALYSIS()
+				--------------------
+				Constructor
+			*/
+			analysis();
+
+			/*
+				ANALYSIS::ANALYSE()
+				-------------------
+				Analyse the tree rooted at root using the given number of threads (0 means one per CPU core).
+			*/
+			void analyse(const node *root, size_t dimensions, size_t threads = 0);
+
+			/*
+				ANALYSIS::LEAF_FILL_FACTOR()
+				----------------------------
+				Return the mean of children / max_children over the nodes directly above the vectors
+			*/
+			double leaf_fill_factor(void) const;
+
+			/*
+				ANALYSIS::DISTORTION()
+				----------------------
+				Return the sum of the squared distances of each vector to the centroid directly above it (the quantisation error)
+			*/
+			double distortion(void) const;
+
+			/*
+				ANALYSIS::SUM_SQUARED_ERROR()
+				-----------------------------
+				Return the sum of squared errors over all levels
+			*/
+			double sum_squared_error(void) const;
+
+			/*
+				ANALYSIS::TEXT_RENDER()
+				-----------------------
+				Serialise the analysis in a human-readable format down the given stream
+			*/
+			void text_render(std::ostream &stream) const;
+
+			/*
+				ANALYSIS::JSON_RENDER()
+				-----------------------
+				Serialise the analysis as a JSON object down the given stream
+			*/
+			void json_render(std::ostream &stream) const;
+		};
+
+	/*
+		OPERATOR<<()
+		------------
+	*/
+	inline std::ostream &operator<<(std::ostream &stream, const analysis &thing)
+		{
+		thing.text_render(stream);
+		return stream;
+		}
+	}
@@ -0,0 +1,156 @@
+/*
+	CONTEXT.H
+	---------
+	Copyright (c) 2020 Andrew Trotman
+	Released under the 2-clause BSD license (See:https://en.wikipedia.org/wiki/BSD_licenses)
+*/
+#pragma once
+
+#include <string.h>
+
+#include <limits>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "object.h"
+#include "statistics.h"
+
+namespace k_tree
+	{
+	/*
+		CLASS PATH_STEP
+		---------------
+		One level of the path an insert takes down the tree (see node::add_to_node())
+	*/
+	class path_step
+		{
+		public:
+			class node *parent;					// the node the insert passed through
+			size_t which_child;					// the child of parent it went to
+			float distance;						// the square of the distance from the vector to that child's centroid
+			size_t child_leaves;					// the number of vectors below that child before the insert
+		};
+
+	/*
+		CLASS CONTEXT
+		-------------
+		The state of a tree that is shared by all of its nodes.  The tree owns one of these and passes it down to the node methods.
+		The settings should be changed before anything is added to the tree.
+	*/
+	class context
+		{
+		public:
+			/*
+				How node::split() divides the children of a full node
+			*/
+			enum split_strategy
+				{
+				CLOSEST_SEEDS,				// 2-means seeded with the first child and the child closest to it
+				FARTHEST_SEEDS,			// 2-means seeded with the ends of an approximate diameter (farthest from the first, then farthest from that)
+				KMEANS_PLUS_PLUS,			// 2-means seeded with a random child then a child chosen with probability proportional to its squared distance
+				PDDP							// principal direction divisive partitioning (no k-means)
+				};
+
+		public:
+			statistics counters;					// the instrumentation counters (only updated when K_TREE_STATS is defined)
+			/*
+				Triangle pruning pays off only when distances are expensive.  Building from gaussian data at order 100, it is 22% faster
+				at 512 dimensions (100,000 vectors) and 11% faster at 128, but 4% slower at 32 (200,000 vectors).  At 32 dimensions it
+				computes a third fewer distances, but skipping a child costs about as much as measuring it.  It also slows search_batch()
+				at 32 dimensions.
+			*/
+			bool triangle_pruning;				// should node::closest() use the triangle inequality to avoid computing distances (see node::closest())
+			float triangle_refresh;				// recompute a child's distances to its siblings once it has moved this fraction of the distance to its nearest sibling
+			split_strategy split_method;		// how node::split() seeds or partitions (see split_strategy)
+			bool running_sums;					// should the nodes keep the sum of the vectors below them (and compute the centroid from that) rather than update the mean
+			size_t lazy_batch;					// if non-zero then a node collects this many updates before its centroid is recomputed (see node::refresh())
+			size_t buffer_size;					// if non-zero then nodes above nodes hold up to this many vectors before passing them down (see node::add_batch_to_node())
+			size_t split_budget;					// if non-zero then each call to push_back() or push_back_batch() splits at most this many nodes, the rest wait (see node::must_split())
+			size_t overflow_slack;				// the number of children more than its order a node may hold while it waits to be split
+			size_t splits_left;					// the number of splits the current insert may still do (see start_insert())
+			bool index_leaves;					// should the tree keep leaf_of so that k_tree::erase() does not have to search for the vector
+			std::unordered_map<class object *, class node *> leaf_of;	// if index_leaves, the leaf holding each vector
+			float dead_fraction;				// a subtree is compacted once more than this fraction of the vectors below it are tombstoned (see k_tree::tombstone())
+			bool collapse_duplicates;			// should a vector with the same bits as one in the tree add to that leaf's count rather than take a new leaf (see k_tree::push_back_weighted())
+			std::unordered_map<class object *, class node *, object_bits, object_bits> leaf_with;	// if collapse_duplicates, the leaf holding each distinct vector (keyed on its bits)
+			float absorb_radius;					// if non-zero then a vector this close to a leaf is absorbed into it, the leaves are micro-clusters rather than vectors (see node::absorb())
+			size_t absorb_budget;				// if non-zero then absorb_radius is doubled whenever the tree would otherwise hold more than this many micro-clusters
+			size_t micro_clusters;				// if absorb_radius is non-zero, the number of leaves in the tree
+			float min_fill;						// on erase, a node with fewer than this fraction of its order as children is merged with or takes children from a sibling (at most 0.5)
+			size_t split_ways;					// the number of nodes node::split() divides a full node into (2 or more, see node::k_means())
+			size_t max_split_ways;				// the most nodes a split can make, set by the tree to its smallest order so that any node can hold them
+			bool split_bounds;					// should node::split() use Hamerly's bounds to avoid recomputing distances (see node::two_means_bounded())
+			size_t split_max_iterations;		// the most k-means iterations node::split() may do (0 for no limit)
+			size_t split_sample;					// if non-zero then node::split() finds the centroids from a random sample of this many children
+			std::mt19937_64 random;				// the random number generator used when sampling (seeded the same way for every tree so the trees are reproducible)
+			std::vector<class object *> scratch;	// workspace vectors for node::split(), allocated when first needed
+			std::vector<class node *> spare_leaves;	// leaves taken out of the tree, to be reused by node::new_node()
+			std::vector<class node *> spare_nodes;		// nodes taken out of the tree (split, merged, or emptied), to be reused by node::new_node()
+			std::vector<std::pair<size_t, float *>> spare_distances;	// the child_distance matrices of spare_nodes (and their capacity)
+			std::vector<path_step> path;		// the stack of nodes the current insert has passed through (see node::add_to_node())
+
+		public:
+			/*
+				CONTEXT::CONTEXT()
+				------------------
+				Constructor
+			*/
+			context() :
+				triangle_pruning(false),
+				triangle_refresh(0.5),
+				split_method(CLOSEST_SEEDS),
+				running_sums(false),
+				lazy_batch(0),
+				buffer_size(0),
+				split_budget(0),
+				overflow_slack(0),
+				splits_left(std::numeric_limits<size_t>::max()),
+				index_leaves(false),
+				dead_fraction(0.25),
+				collapse_duplicates(false),
+				absorb_radius(0),
+				absorb_budget(0),
+				micro_clusters(0),
+				min_fill(0.25),
+				split_ways(2),
+				max_split_ways(std::numeric_limits<size_t>::max()),
+				split_bounds(false),
+				split_max_iterations(0),
+				split_sample(0)
+				{
+				/* Nothing */
+				}
+
+			/*
+				CONTEXT::START_INSERT()
+				-----------------------
+				Give the insert that is about to start its budget of splits (see split_budget)
+			*/
+			void start_insert(void)
+				{
+				splits_left = split_budget == 0 ? std::numeric_limits<size_t>::max() : split_budget;
+				}
+
+			/*
+				CONTEXT::SPLIT_STRATEGY_OF()
+				----------------------------
+				Turn a name (closest, farthest, kmeans++, or pddp) into a split_strategy.  Returns false if the name is not known
+			*/
+			static bool split_strategy_of(const char *name, split_strategy &answer)
+				{
+				if (strcmp(name, "closest") == 0)
+					answer = CLOSEST_SEEDS;
+				else if (strcmp(name, "farthest") == 0)
+					answer = FARTHEST_SEEDS;
+				else if (strcmp(name, "kmeans++") == 0)
+					answer = KMEANS_PLUS_PLUS;
+				else if (strcmp(name, "pddp") == 0)
+					answer = PDDP;
+				else
+					return false;
+
+				return true;
+				}
+		};
+	}
@@ -0,0 +1,236 @@
+/*
+	GENERATOR.CPP
+	-------------
+	Copyright (c) 2020 Andrew Trotman
+	Released under the 2-clause BSD license (See:https://en.wikipedia.org/wiki/BSD_licenses)
+*/
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "generator.h"
+
+namespace k_tree
+	{
+	/*
+		GENERATOR::GENERATOR()
+		----------------------
+		Constructor
+	*/
+	generator::generator(distribution shape, size_t dimensions, uint64_t seed, size_t clusters, float spread, double skew, size_t rank) :
+		random(seed),
+		shape(shape),
+		dimensions(dimensions),
+		clusters(clusters == 0 ? 1 : clusters),
+		rank(std::min(rank == 0 ? 1 : rank, dimensions)),
+		spread(spread),
+		have_spare(false),
+		spare(0)
+		{
+		/*
+			The cluster centres live in the low dimensional space for LOW_RANK and in the full space for the others
+		*/
+		size_t centre_width = shape == LOW_RANK ? this->rank : dimensions;
+
+		if (shape != UNIFORM)
+			{
+			centres.resize(this->clusters * centre_width);
+			for (auto &value : centres)
+				value = (float)(uniform_deviate() * 2.0 - 1.0);
+			}
+
+		/*
+			The cluster weights are equal except for HEAVY_TAILED where the i-th largest cluster has weight proportional to 1 / i^skew
+		*/
+		double total = 0;
+		cumulative.resize(this->clusters);
+		for (size_t which = 0; which < this->clusters; which++)
+			{
+			total += shape == HEAVY_TAILED ? 1.0 / pow((double)(which + 1), skew) : 1.0;
+			cumulative[which] = total;
+			}
+		for (auto &value : cumulative)
+			value /= total;
+
+		/*
+			The random projection from the low dimensional space is Gaussian, scaled so that the vector lengths are (roughly) preserved
+		*/
+		if (shape == LOW_RANK)
+			{
+			double scale = 1.0 / sqrt((double)this->rank);
+			basis.resize(this->rank * dimensions);
+			for (auto &value : basis)
+				value = (float)(normal_deviate() * scale);
+			latent.resize(this->rank);
+			}
+		}
+
+	/*
+		GENERATOR::UNIFORM_DEVIATE()
+		----------------------------
+		Return a uniform random number in [0, 1)
+	*/
+	double generator::uniform_deviate(void)
+		{
+		return (random() >> 11) * (1.0 / 9007199254740992.0);			// 53 random bits divided by 2^53
+		}
+
+	/*
+		GENERATOR::NORMAL_DEVIATE()
+		---------------------------
+		Return a random number from the standard normal distribution (using the Box-Muller transform)
+	*/
+	double generator::normal_deviate(void)
+		{
+		if (have_spare)
+			{
+			have_spare = false;
+			return spare;
+			}
+
+		double u1 = 1.0 - uniform_deviate();				// (0, 1] so that log() is defined
+		double u2 = uniform_deviate();
+		double radius = sqrt(-2.0 * log(u1));
+		double theta = 2.0 * M_PI * u2;
+
+		spare = radius * sin(theta);
+		have_spare = true;
+		return radius * cos(theta);
+		}
+
+	/*
+		GENERATOR::CHOOSE_CLUSTER()
+		---------------------------
+		Return the index of a cluster chosen at random according to the cluster weights
+	*/
+	size_t generator::choose_cluster(void)
+		{
+		size_t which = std::upper_bound(cumulative.begin(), cumulative.end(), uniform_deviate()) - cumulative.begin();
+		return which < clusters ? which : clusters - 1;
+		}
+
+	/*
+		GENERATOR::NEXT()
+		-----------------
+		Write the next vector (of dimensions floats) into the parameter
+	*/
+	void generator::next(float *into)
+		{
+		switch (shape)
+			{
+			case UNIFORM:
+				for (size_t dimension = 0; dimension < dimensions; dimension++)
+					into[dimension] = (float)(uniform_deviate() * 2.0 - 1.0);
+				break;
+
+			case GAUSSIAN_MIXTURE:
+			case HEAVY_TAILED:
+				{
+				const float *centre = &centres[choose_cluster() * dimensions];
+				for (size_t dimension = 0; dimension < dimensions; dimension++)
+					into[dimension] = centre[dimension] + (float)(normal_deviate() * spread);
+				break;
+				}
+
+			case LOW_RANK:
+				{
+				/*
+					Generate the point in the low dimensional space, project it, then add a little full-dimensional noise
+				*/
+				const float *centre = &centres[choose_cluster() * rank];
+				for (size_t dimension = 0; dimension < rank; dimension++)
+					latent[dimension] = centre[dimension] + (float)(normal_deviate() * spread);
+
+				for (size_t dimension = 0; dimension < dimensions; dimension++)
+					{
+					float value = 0;
+					for (size_t component = 0; component < rank; component++)
+						value += latent[component] * basis[component * dimensions + dimension];
+					into[dimension] = value + (float)(normal_deviate() * spread * 0.1);
+					}
+				break;
+				}
+			}
+		}
+
+	/*
+		GENERATOR::DISTRIBUTION_OF()
+		----------------------------
+		Convert the name of a distribution into a distribution.  Returns true on success
+	*/
+	bool generator::distribution_of(const char *name, distribution &answer)
+		{
+		if (strcmp(name, "uniform") == 0)
+			answer = UNIFORM;
+		else if (strcmp(name, "gaussian") == 0)
+			answer = GAUSSIAN_MIXTURE;
+		else if (strcmp(name, "heavy") == 0)
+			answer = HEAVY_TAILED;
+		else if (strcmp(name, "lowrank") == 0)
+			answer = LOW_RANK;
+		else
+			return false;
+
+		return true;
+		}
+
+	/*
+		GENERATOR::UNITTEST()
+		---------------------
+		Unit test this class
+	*/
+	void generator::unittest(void)
+		{
+		constexpr size_t dimensions = 5;
+		float first[dimensions];
+		float second[dimensions];
+
+		for (distribution shape : {UNIFORM, GAUSSIAN_MIXTURE, HEAVY_TAILED, LOW_RANK})
+			{
+			/*
+				The same seed must give the same sequence
+			*/
+			generator one(shape, dimensions, 42, 4);
+			generator two(shape, dimensions, 42, 4);
+			for (size_t vector = 0; vector < 100; vector++)
+				{
+				one.next(first);
+				two.next(second);
+				assert(memcmp(first, second, sizeof(first)) == 0);
+				}
+
+			/*
+				A different seed should give a different sequence
+			*/
+			generator three(shape, dimensions, 43, 4);
+			three.next(second);
+			one.next(first);
+			assert(memcmp(first, second, sizeof(first)) != 0);
+			}
+
+		/*
+			Uniform data must be in range
+		*/
+		generator uniform(UNIFORM, dimensions, 7);
+		for (size_t vector = 0; vector < 1000; vector++)
+			{
+			uniform.next(first);
+			for (size_t dimension = 0; dimension < dimensions; dimension++)
+				assert(first[dimension] >= -1.0 && first[dimension] < 1.0);
+			}
+
+		/*
+			The heavy tailed distribution must put more points in the first cluster than in the last
+		*/
+		generator heavy(HEAVY_TAILED, dimensions, 7, 10);
+		size_t counts[10] = {};
+		for (size_t vector = 0; vector < 10000; vector++)
+			counts[heavy.choose_cluster()]++;
+		assert(counts[0] > 2 * counts[9]);
+
+		puts("generator::PASS");
+		}
+	}
@@ -0,0 +1,105 @@
+/*
+	GENERATOR.H
+	-----------
+	Copyright (c) 2020 Andrew Trotman
+	Released under the 2-clause BSD license (See:https://en.wikipedia.org/wiki/BSD_licenses)
+*/
+#pragma once
+
+#include <stdint.h>
+
+#include <random>
+#include <vector>
+
+namespace k_tree
+	{
+	/*
+		CLASS GENERATOR
+		---------------
+		Seeded generator of synthetic vectors for benchmarking.  The random numbers come from std::mt19937_64 (which is fully specified
+		by the standard) and are converted into uniform and normal deviates here rather than by the std:: distributions (which are not),
+		so the same seed produces the same vectors on every platform.
+	*/
+	class generator
+		{
+		public:
+			/*
+				ENUM GENERATOR::DISTRIBUTION
+				----------------------------
+				The shape of the data
+			*/
+			enum distribution
+				{
+				UNIFORM,						// each dimension uniform on [-1, 1]
+				GAUSSIAN_MIXTURE,			// equally likely Gaussian clusters with centres uniform on [-1, 1]
+				HEAVY_TAILED,				// Gaussian clusters whose sizes follow a Zipf distribution
+				LOW_RANK						// a Gaussian mixture in a low dimensional space randomly projected into the full dimensionality
+				};
+
+		private:
+			std::mt19937_64 random;					// the source of randomness
+			distribution shape;						// the shape of the data being generated
+			size_t dimensions;						// the dimensionality of the vectors being generated
+			size_t clusters;							// the number of clusters (for all but UNIFORM)
+			size_t rank;								// the intrinsic dimensionality (for LOW_RANK)
+			float spread;								// the standard deviation of each cluster
+			std::vector<float> centres;			// clusters * (rank or dimensions) cluster centres
+			std::vector<double> cumulative;		// the cumulative probability of choosing each cluster
+			std::vector<float> basis;				// the rank * dimensions projection matrix (for LOW_RANK)
+			std::vector<float> latent;				// scratch space for the low dimensional point (for LOW_RANK)
+			bool have_spare;							// Box-Muller generates normals in pairs, is there one left over?
+			double spare;								// the left over normal deviate
+
+		private:
+			/*
+				GENERATOR::UNIFORM_DEVIATE()
+				----------------------------
+				Return a uniform random number in [0, 1)
+			*/
+			double uniform_deviate(void);
+
+			/*
+				GENERATOR::NORMAL_DEVIATE()
+				---------------------------
+				Return a random number from the standard normal distribution (using the Box-Muller transform)
+			*/
+			double normal_deviate(void);
+
+			/*
+				GENERATOR::CHOOSE_CLUSTER()
+				---------------------------
+				Return the index of a cluster chosen at random according to the cluster weights
+			*/
+			size_t choose_cluster(void);
+
+		public:
+			/*
+				GENERATOR::GENERATOR()
+				----------------------
+				Constructor.  The cluster centres (and projection) are drawn from the seed so two generators with the same parameters produce
+				the same data.  skew is the Zipf exponent for HEAVY_TAILED, rank is the intrinsic dimensionality for LOW_RANK.
+			*/
+			generator(distribution shape, size_t dimensions, uint64_t seed = 1, size_t clusters = 16, float spread = 0.05, double skew = 1.1, size_t rank = 8);
+
+			/*
+				GENERATOR::NEXT()
+				-----------------
+				Write the next vector (of dimensions floats) into the parameter
+			*/
+			void next(float *into);
+
+			/*
+				GENERATOR::DISTRIBUTION_OF()
+				----------------------------
+				Convert the name of a distribution into a distribution.  Returns true on success
+			*/
+			static bool distribution_of(const char *name, distribution &answer);
+
+			/*
+				GENERATOR::UNITTEST()
+				---------------------
+				Unit test this class
+			*/
+			static void unittest(void);
+		};
+	}
@@ -4,6 +4,13 @@
 	Copyright (c) 2020 Andrew Trotman
 	Released under the 2-clause BSD license (See:https://en.wikipedia.org/wiki/BSD_licenses)
 */
+#include <math.h>
+#include <assert.h>
+
+#include <limits>
+#include <sstream>
+#include <algorithm>
+
 #include "k_tree.h"
 
 namespace k_tree
@@ -15,15 +22,73 @@ namespace k_tree
 	*/
 
 	k_tree::k_tree(allocator *memory, size_t tree_order, size_t vector_order) :
+		k_tree(memory, tree_order, tree_order, vector_order)
+		{
+		/* Nothing */
+		}
+
+	/*
+		K_TREE::K_TREE()
+		----------------
+		Constructor
+	*/
+	k_tree::k_tree(allocator *memory, size_t leaf_order, size_t internal_order, size_t vector_order) :
 		parameters(nullptr),
+		internal_parameters(nullptr),
 		root(nullptr),
 		memory(memory)
 		{
 		parameters = new (memory->malloc(sizeof(*parameters))) node();
-		parameters->max_children = tree_order;
+		parameters->max_children = leaf_order;
 		parameters->centroid = new (memory->malloc(sizeof(*parameters->centroid))) object();
 		parameters->centroid->dimensions = vector_order;
-		/* Nothing */
+
+		internal_parameters = new (memory->malloc(sizeof(*internal_parameters))) node();
+		internal_parameters->max_children = internal_order;
+		internal_parameters->centroid = parameters->centroid;
+
+		/*
+			A split must not make more nodes than the smallest node can hold
+		*/
+		tree_context.max_split_ways = std::min(leaf_order, internal_order);
+		}
+
+	/*
+		K_TREE::NEW_ROOT()
+		------------------
+		The root has split so create a new root consisting of the nodes the old root was split into
+	*/
+	void k_tree::new_root(allocator *memory, const std::vector<node *> &replacement)
+		{
+		root->recycle(&tree_context);
+		node *top = internal_parameters->new_node(&tree_context, memory, replacement[0]);
+		for (size_t which = 1; which < replacement.size(); which++)
+			{
+			top->child[top->children++] = replacement[which];
+			top->dead_below += replacement[which]->dead_below;
+			replacement[which]->parent = top;
+			}
+		root = top;
+		root->compute_mean(&tree_context, memory);
+		}
+
+	/*
+		K_TREE::ADD_BATCH()
+		-------------------
+		Add the vectors in batch to the (non-empty) tree, emptying batch
+	*/
+	void k_tree::add_batch(allocator *memory, std::vector<object *> &batch)
+		{
+		std::vector<object *> leftover;
+		std::vector<node *> replacement;
+
+		while (!batch.empty())
+			{
+			leftover.clear();
+			if (root->add_batch_to_node(&tree_context, memory, &batch[0], batch.size(), leftover, replacement))
+				new_root(memory, replacement);
+			batch.swap(leftover);
+			}
 		}
 
 	/*
@@ -31,11 +96,53 @@ namespace k_tree
 		-------------------
 		Add to the tree
 	*/
-	void k_tree::push_back(allocator *memory, object *data)
+	bool k_tree::push_back(allocator *memory, object *data)
+		{
+		return push_back_weighted(memory, data, 1);
+		}
+
+	/*
+		K_TREE::PUSH_BACK_WEIGHTED()
+		----------------------------
+	*/
+	bool k_tree::push_back_weighted(allocator *memory, object *data, size_t weight)
+		{
+		/*
+			Micro-clusters already merge identical vectors (see node::absorb())
+		*/
+		if (tree_context.collapse_duplicates && tree_context.absorb_radius == 0 && add_to_duplicate(memory, data, weight))
+			return false;
+
+		insert(memory, data, weight);
+		return true;
+		}
+
+	/*
+		K_TREE::INSERT()
+		----------------
+	*/
+	void k_tree::insert(allocator *memory, object *data, size_t weight)
 		{
+		/*
+			With buffered insertion the vector joins the root's buffer.  The buffers do not hold weights so a weighted vector goes
+			straight down, once the buffers are empty
+		*/
+		if (tree_context.buffer_size != 0)
+			{
+			if (weight == 1)
+				{
+				std::vector<object *> batch(1, data);
+				route_batch(memory, batch);
+				return;
+				}
+			flush_buffers(memory);
+			}
+
 		bool did_split = false;
-		node *child_1;
-		node *child_2;
+		std::vector<node *> replacement;
+		K_TREE_COUNT(size_t nodes_visited_before = tree_context.counters.nodes_visited);
+		K_TREE_COUNT(tree_context.counters.inserts++);
+		tree_context.start_insert();
 
 		/*
 			Add to the tree
@@ -45,77 +152,1518 @@ namespace k_tree
 			/*
 				The very first add to the tree so create a node with one child
 			*/
-			node *leaf = parameters->new_node(memory, data);
-			root = parameters->new_node(memory, leaf);
-			root->compute_mean();
+			node *leaf = parameters->new_node(&tree_context, memory, data);
+			leaf->leaves_below_this_point = weight;
+			root = parameters->new_node(&tree_context, memory, leaf);
+			root->compute_mean(&tree_context, memory);
 			}
 		else
-			did_split = root->add_to_node(memory, data, &child_1, &child_2);
+			did_split = root->add_to_node(&tree_context, memory, data, weight, replacement);
 
 		/*
-			Adding caused a split at the top level so we create a new root consisting of the two children
+			Adding caused a split at the top level
 		*/
 		if (did_split)
+			new_root(memory, replacement);
+
+#ifdef K_TREE_STATS
+		size_t nodes_visited = tree_context.counters.nodes_visited - nodes_visited_before;
+		if (nodes_visited > tree_context.counters.max_nodes_visited)
+			tree_context.counters.max_nodes_visited = nodes_visited;
+#endif
+		}
+
+	/*
+		K_TREE::PUSH_BACK_BATCH()
+		-------------------------
+		Add data[0..count-1] to the tree, routing them down the tree together (see node::add_batch_to_node()).  This does not
+		build the same tree as adding them one at a time, as the vectors in a group are routed on the centroids as they were before
+		any of them were added
+	*/
+	size_t k_tree::push_back_batch(allocator *memory, object *const *data, size_t count, std::vector<object *> *collapsed)
+		{
+		std::vector<object *> batch;
+		if (tree_context.collapse_duplicates && tree_context.absorb_radius == 0)
 			{
-			node *new_root = parameters->new_node(memory, child_1);
-			new_root->child[1] = child_2;
-			new_root->children = 2;
-			root = new_root;
-			child_1->compute_mean();
-			child_2->compute_mean();
-			root->compute_mean();
+			for (size_t which = 0; which < count; which++)
+				if (!add_to_duplicate(memory, data[which], 1))
+					batch.push_back(data[which]);
+				else if (collapsed != nullptr)
+					collapsed->push_back(data[which]);
 			}
+		else
+			batch.assign(data, data + count);
+
+		size_t kept = batch.size();
+		route_batch(memory, batch);
+
+		return kept;
 		}
 
 	/*
-		K_TREE::GET_EXAMPLE_OBJECT
+		K_TREE::ROUTE_BATCH()
+		---------------------
+		Add the vectors in batch to the tree (which may be empty) as new leaves, with no check for duplicates, emptying batch
+	*/
+	void k_tree::route_batch(allocator *memory, std::vector<object *> &batch)
+		{
+		K_TREE_COUNT(tree_context.counters.inserts += batch.size());
+		tree_context.start_insert();
+
+		if (batch.empty())
+			return;
+
+		if (root == nullptr)
+			{
+			/*
+				The very first add to the tree so create a node with one child
+			*/
+			node *leaf = parameters->new_node(&tree_context, memory, batch[0]);
+			root = parameters->new_node(&tree_context, memory, leaf);
+			root->compute_mean(&tree_context, memory);
+			batch.erase(batch.begin());
+			}
+
+		add_batch(memory, batch);
+		}
+
+	/*
+		K_TREE::ERASE()
+		---------------
+		Remove data (compared by address) from the tree.  Returns whether or not data was in the tree
+	*/
+	bool k_tree::erase(allocator *memory, object *data)
+		{
+		std::vector<path_step> &path = tree_context.path;
+
+		if (!find(memory, data, path))
+			return false;
+
+		K_TREE_COUNT(tree_context.counters.erases++);
+		remove(memory, path);
+
+		return true;
+		}
+
+	/*
+		K_TREE::FIND()
+		--------------
+		Put the path from the root to the leaf holding data in path.  Returns whether or not data is in the tree
+	*/
+	bool k_tree::find(allocator *memory, object *data, std::vector<path_step> &path)
+		{
+		if (root == nullptr)
+			return false;
+
+		/*
+			The vector might be waiting in a buffer, so pass everything down first (and finish any waiting splits)
+		*/
+		if (tree_context.buffer_size != 0 || tree_context.split_budget != 0)
+			finish_splits(memory);
+
+		if (!tree_context.index_leaves)
+			return root->locate(&tree_context, data, path);
+
+		auto found = tree_context.leaf_of.find(data);
+		if (found == tree_context.leaf_of.end())
+			return false;
+
+		path_to(found->second, path);
+		return true;
+		}
+
+	/*
+		K_TREE::PATH_TO()
+		-----------------
+		Put the path from the root to the given leaf in path by following the parents up from the leaf
+	*/
+	void k_tree::path_to(node *leaf, std::vector<path_step> &path)
+		{
+		path_step step;
+
+		step.distance = 0;
+		step.child_leaves = 0;
+		path.clear();
+		for (node *below = leaf; below->parent != nullptr; below = below->parent)
+			{
+			step.parent = below->parent;
+			step.which_child = std::find(step.parent->child, step.parent->child + step.parent->children, below) - step.parent->child;
+			path.push_back(step);
+			}
+		std::reverse(path.begin(), path.end());
+		}
+
+	/*
+		K_TREE::REMOVE()
+		----------------
+		Remove the leaf at the end of path from the tree
+	*/
+	void k_tree::remove(allocator *memory, std::vector<path_step> &path)
+		{
+		node *leaf = path.back().parent->child[path.back().which_child];
+		object *data = leaf->centroid;
+
+		if (tree_context.index_leaves)
+			tree_context.leaf_of.erase(data);
+		if (tree_context.collapse_duplicates)
+			{
+			auto found = tree_context.leaf_with.find(data);
+			if (found != tree_context.leaf_with.end() && found->second == leaf)
+				tree_context.leaf_with.erase(found);
+			}
+
+		/*
+			Take the vector out of every node above it, then remove it from the node directly above it
+		*/
+		for (const auto &step : path)
+			{
+			step.parent->forget(&tree_context, data, leaf->leaves_below_this_point);
+			step.parent->dead_below -= leaf->dead_below;
+			}
+		path.back().parent->remove_child(&tree_context, memory, path.back().which_child);
+		leaf->recycle(&tree_context);
+
+		/*
+			Walk back up fixing any node that has too few children, and the distances to the children that moved
+		*/
+		for (size_t level = path.size() - 1; level > 0; level--)
+			{
+			node *current = path[level].parent;
+			const path_step &above = path[level - 1];
+
+			if (current->underflows(&tree_context))
+				above.parent->rebalance(&tree_context, memory, above.which_child);
+			else if (above.parent->inner->child_distance != nullptr)
+				above.parent->update_child_distances(&tree_context, above.which_child);
+			}
+
+		/*
+			A root with one child is not needed (unless that child is a vector), and an empty tree has no root
+		*/
+		while (root->children == 1 && !root->child[0]->isleaf())
+			{
+			root->recycle(&tree_context);
+			root = root->child[0];
+			root->parent = nullptr;
+			}
+		if (root->children == 0)
+			{
+			root->recycle(&tree_context);
+			root = nullptr;
+			}
+		}
+
+	/*
+		K_TREE::UPDATE()
+		----------------
+		Change the vector data to the values in new_vector.  Returns whether or not data was in the tree (and not deleted)
+	*/
+	bool k_tree::update(allocator *memory, object *data, object *new_vector)
+		{
+		std::vector<path_step> &path = tree_context.path;
+
+		if (!find(memory, data, path))
+			return false;
+		node *leaf = path.back().parent->child[path.back().which_child];
+		if (leaf->dead_below != 0)
+			return false;
+
+		K_TREE_COUNT(tree_context.counters.updates++);
+		size_t weight = leaf->leaves_below_this_point;
+
+		/*
+			If the vector has moved closer to another node at the level above the vectors then take it out and add it again (the
+			nodes above that level are not checked, so a vector that moves a long way might not end up where an insert would put it)
+		*/
+		if (path.size() > 1)
+			{
+			const path_step &above = path[path.size() - 2];
+			if (above.parent->closest(&tree_context.counters, new_vector) != above.which_child)
+				{
+				K_TREE_COUNT(tree_context.counters.relocations++);
+				remove(memory, path);
+				*data = *new_vector;
+				insert(memory, data, weight);
+				return true;
+				}
+			}
+
+		/*
+			Otherwise change it where it is: move the centroids above it, and the bounds on how far they have moved (see
+			node::closest()).  The leaf stays the one duplicates of it go to, under its new bits
+		*/
+		bool registered = false;
+		if (tree_context.collapse_duplicates)
+			{
+			auto found = tree_context.leaf_with.find(data);
+			if (found != tree_context.leaf_with.end() && found->second == leaf)
+				{
+				tree_context.leaf_with.erase(found);
+				registered = true;
+				}
+			}
+		float moved = sqrtf(data->distance_squared(new_vector));
+		for (const auto &step : path)
+			{
+			step.parent->shift(&tree_context, data, new_vector, weight);
+			if (step.parent->inner->child_distance != nullptr)
+				{
+				node *below = step.parent->child[step.which_child];
+				float *drift = step.parent->child_drift();
+				drift[step.which_child] += moved * weight / below->leaves_below_this_point;
+				if (drift[step.which_child] > tree_context.triangle_refresh * step.parent->child_nearest()[step.which_child])
+					step.parent->update_child_distances(&tree_context, step.which_child);
+				}
+			}
+		*data = *new_vector;
+		if (registered)
+			{
+			tree_context.leaf_with.erase(data);
+			tree_context.leaf_with.emplace(data, leaf);
+			}
+
+		return true;
+		}
+
+	/*
+		K_TREE::ADD_TO_DUPLICATE()
 		--------------------------
-		Return an example vector
 	*/
-	object *k_tree::get_example_object(void)
+	bool k_tree::add_to_duplicate(allocator *memory, object *data, size_t weight)
 		{
-		return parameters->centroid;
+		std::vector<path_step> &path = tree_context.path;
+
+		auto found = tree_context.leaf_with.find(data);
+		if (found == tree_context.leaf_with.end() || found->second->dead_below != 0)
+			return false;
+
+		node *leaf = found->second;
+		K_TREE_COUNT(tree_context.counters.inserts++);
+		K_TREE_COUNT(tree_context.counters.duplicates++);
+
+		/*
+			The leaf counts the copy, and each node above it is updated as if the copy had been inserted (bottom up, as an insert
+			leaves them).  The leaf itself does not move, but each node above it does so its parent's bound on that is increased
+			(see node::closest())
+		*/
+		path_to(leaf, path);
+		leaf->leaves_below_this_point += weight;
+		for (size_t level = path.size(); level-- > 0;)
+			{
+			node *current = path[level].parent;
+			float distance = sqrtf(data->distance_squared(current->centroid));
+
+			current->count_in(&tree_context, memory, data, weight);
+
+			if (level > 0 && path[level - 1].parent->inner->child_distance != nullptr)
+				{
+				const path_step &above = path[level - 1];
+				float *drift = above.parent->child_drift();
+				drift[above.which_child] += distance * weight / current->leaves_below_this_point;
+				if (drift[above.which_child] > tree_context.triangle_refresh * above.parent->child_nearest()[above.which_child])
+					above.parent->update_child_distances(&tree_context, above.which_child);
+				}
+			}
+
+		return true;
 		}
 
 	/*
-		K_TREE::TEXT_RENDER()
-		---------------------
-		Serialsise a human-readable version of tree to the stream
+		K_TREE::TOMBSTONE()
+		-------------------
+		Mark data as deleted.  Returns whether or not data was in the tree (and not already deleted)
 	*/
-	void k_tree::text_render(std::ostream &stream) const
+	bool k_tree::tombstone(allocator *memory, object *data)
 		{
-		if (root != nullptr)
-			root->text_render(stream);
+		std::vector<path_step> &path = tree_context.path;
+
+		if (!mark_dead(memory, data))
+			return false;
+
+		/*
+			Compact the largest subtree on the path that is now too dead (the path is from the root down)
+		*/
+		for (const auto &step : path)
+			if (step.parent->dead_below > tree_context.dead_fraction * step.parent->leaves_below_this_point)
+				{
+				compact(memory, step.parent);
+				break;
+				}
+
+		return true;
 		}
 
 	/*
-		K_TREE::UNITTEST()
-		------------------
-		Test the class
+		K_TREE::MARK_DEAD()
+		-------------------
 	*/
-	void k_tree::unittest(void)
+	bool k_tree::mark_dead(allocator *memory, object *data)
 		{
-		constexpr size_t dimensions = 2;
-		object initial(dimensions);
-		allocator memory;
-		k_tree tree(&memory, 4, dimensions);
-		size_t total_adds = 16;
+		std::vector<path_step> &path = tree_context.path;
 
-		for (size_t which = 0; which < total_adds; which++)
+		if (!find(memory, data, path))
+			return false;
+
+		node *leaf = path.back().parent->child[path.back().which_child];
+		if (leaf->dead_below != 0)
+			return false;
+
+		K_TREE_COUNT(tree_context.counters.tombstones++);
+		leaf->dead_below = leaf->leaves_below_this_point;
+		for (const auto &step : path)
+			step.parent->dead_below += leaf->dead_below;
+
+		return true;
+		}
+
+	/*
+		K_TREE::COMPACT()
+		-----------------
+		Remove every tombstoned vector at or below the given node (nullptr for the whole tree)
+	*/
+	void k_tree::compact(allocator *memory, node *subtree)
+		{
+		std::vector<node *> dead;
+		std::vector<path_step> &path = tree_context.path;
+
+		if (subtree == nullptr)
+			subtree = root;
+		if (subtree == nullptr)
+			return;
+
+		K_TREE_COUNT(tree_context.counters.compactions++);
+		subtree->collect_dead(dead);
+		for (node *leaf : dead)
 			{
-			object &data = *initial.new_object(&memory);
-			for (size_t dimension = 0; dimension < initial.dimensions; dimension++)
-				if (which < 8)
-					data.vector[dimension] = (rand() % 20) / (float)10.0;
-				else
-					data.vector[dimension] = ((rand() % 20) + 70) / (float)10.0;
+			path_to(leaf, path);
+			remove(memory, path);
+			}
+		}
 
-std::cout << "-----------> " << data << "\n";
-			tree.push_back(&memory, &data);
-std::cout << tree << "\n";
+	/*
+		K_TREE::PUSH_BACK()
+		-------------------
+	*/
+	bool k_tree::push_back(allocator *memory, object *data, uint64_t timestamp)
+		{
+		/*
+			A micro-cluster does not keep the vectors it absorbs, so there would be nothing for expire() to remove
+		*/
+		if (tree_context.absorb_radius != 0)
+			return false;
+
+		insert(memory, data, 1);
+		window.push_back(std::make_pair(timestamp, data));
+		return true;
+		}
+
+	/*
+		K_TREE::EXPIRE()
+		----------------
+	*/
+	size_t k_tree::expire(allocator *memory, uint64_t before, std::vector<object *> *expired)
+		{
+		size_t removed = 0;
+
+		/*
+			Vectors still in a buffer are not yet in the tree so can't be found
+		*/
+		if (tree_context.buffer_size != 0)
+			flush_buffers(memory);
+
+		while (!window.empty() && window.front().first < before)
+			{
+			object *data = window.front().second;
+			window.pop_front();
+
+			if (mark_dead(memory, data))
+				{
+				removed++;
+				if (expired != nullptr)
+					expired->push_back(data);
+				}
 			}
 
-std::cout << "TREE (" << total_adds << " adds)\n";
-std::cout << tree;
+		if (removed != 0)
+			compact(memory);
+
+		return removed;
+		}
+
+	/*
+		K_TREE::FLUSH_BUFFERS()
+		-----------------------
+		Pass every vector waiting in a buffer down to the nodes directly above the vectors (see context::buffer_size).  Do this before
+		searching or analysing a tree built with buffered insertion
+	*/
+	void k_tree::flush_buffers(allocator *memory)
+		{
+		std::vector<object *> leftover;
+		std::vector<node *> replacement;
+
+		if (root == nullptr)
+			return;
+
+		tree_context.splits_left = std::numeric_limits<size_t>::max();
+
+		/*
+			If the root splits then the vectors it gives back are added again (and perhaps buffered again), so keep going until nothing splits
+		*/
+		while (root->flush_buffers(&tree_context, memory, leftover, replacement))
+			{
+			new_root(memory, replacement);
+			add_batch(memory, leftover);
+			}
+		}
+
+	/*
+		K_TREE::FINISH_SPLITS()
+		-----------------------
+		Empty the buffers then split every node that is waiting to be split (see context::split_budget)
+	*/
+	void k_tree::finish_splits(allocator *memory)
+		{
+		std::vector<node *> replacement;
+
+		if (root == nullptr)
+			return;
+
+		flush_buffers(memory);
+		tree_context.splits_left = std::numeric_limits<size_t>::max();
+		while (root->split_overfull(&tree_context, memory, replacement))
+			new_root(memory, replacement);
+		}
+
+	/*
+		K_TREE::REFRESH_CENTROIDS()
+		---------------------------
+		Apply every deferred centroid update (see context::lazy_batch).  Do this before searching or analysing a tree built with
+		lazy centroids
+	*/
+	void k_tree::refresh_centroids(void)
+		{
+		if (root != nullptr)
+			root->refresh_subtree(&tree_context);
+		}
+
+	/*
+		K_TREE::SEARCH()
+		----------------
+		Approximate k-nearest neighbour search.  Descend the tree keeping the beam_width nodes closest to the query at each level,
+		then return (in results) the k vectors below those nodes that are closest to the query, as (distance squared, vector) pairs
+		closest first.  A beam_width of 1 follows the same path as an insert would.
+	*/
+	void k_tree::search(std::vector<std::pair<float, object *>> &results, object *query, size_t k, size_t beam_width) const
+		{
+		std::vector<std::pair<float, const node *>> beam;
+		std::vector<std::pair<float, const node *>> next_beam;
+		auto closer = [](const std::pair<float, const node *> &a, const std::pair<float, const node *> &b) { return a.first < b.first; };
+
+		results.clear();
+		if (root == nullptr || k == 0)
+			return;
+		if (beam_width == 0)
+			beam_width = 1;
+
+		/*
+			The tree is height balanced so all the nodes in the beam are at the same level, walk down until we are directly above the vectors.
+			Subtrees (and vectors) that are all tombstoned are skipped.
+		*/
+		beam.push_back(std::make_pair(0.0f, root));
+		while (!beam.empty() && !beam[0].second->child[0]->isleaf())
+			{
+			next_beam.clear();
+			for (const auto &current : beam)
+				for (size_t which = 0; which < current.second->children; which++)
+					if (current.second->child[which]->dead_below != current.second->child[which]->leaves_below_this_point)
+						next_beam.push_back(std::make_pair(query->distance_squared(current.second->child[which]->centroid), current.second->child[which]));
+
+			if (next_beam.size() > beam_width)
+				{
+				std::partial_sort(next_beam.begin(), next_beam.begin() + beam_width, next_beam.end(), closer);
+				next_beam.resize(beam_width);
+				}
+			beam.swap(next_beam);
+			}
+
+		/*
+			Now find the closest vectors below the beam
+		*/
+		for (const auto &current : beam)
+			for (size_t which = 0; which < current.second->children; which++)
+				if (current.second->child[which]->dead_below == 0)
+					results.push_back(std::make_pair(query->distance_squared(current.second->child[which]->centroid), current.second->child[which]->centroid));
+
+		size_t keep = std::min(k, results.size());
+		std::partial_sort(results.begin(), results.begin() + keep, results.end(), [](const std::pair<float, object *> &a, const std::pair<float, object *> &b) { return a.first < b.first; });
+		results.resize(keep);
+		}
+
+	/*
+		K_TREE::NEAREST_LIVE()
+		----------------------
+		Return the index of the child of current closest to query that is not all tombstoned.  current must itself not be all
+		tombstoned.  The distances computed are added to counters
+	*/
+	size_t k_tree::nearest_live(statistics *counters, const node *current, object *query)
+		{
+		if (current->dead_below == 0)
+			return current->closest(counters, query);
+
+		size_t nearest = current->children;
+		float nearest_distance = std::numeric_limits<float>::max();
+		for (size_t which = 0; which < current->children; which++)
+			if (current->child[which]->dead_below != current->child[which]->leaves_below_this_point)
+				{
+				float distance = query->distance_squared(current->child[which]->centroid, nearest_distance);
+				if (nearest == current->children || distance < nearest_distance)
+					{
+					nearest_distance = distance;
+					nearest = which;
+					}
+				}
+
+		return nearest;
+		}
+
+	/*
+		K_TREE::SEARCH_BATCH()
+		----------------------
+		Search for each of queries[0..count-1] (with a beam width of 1) putting the k vectors found for queries[i] in results[i]
+	*/
+	void k_tree::search_batch(std::vector<std::vector<std::pair<float, object *>>> &results, object *const *queries, size_t count, size_t k, size_t group) const
+		{
+		statistics counters;				// node::closest() counts distance computations, but the tree is not changed by a search
+		std::vector<const node *> at;
+
+		results.resize(count);
+		for (auto &found : results)
+			found.clear();
+		if (root == nullptr || k == 0 || root->dead_below == root->leaves_below_this_point)
+			return;
+		if (group == 0)
+			group = 1;
+
+		root->prefetch_children();
+		for (size_t first = 0; first < count; first += group)
+			{
+			size_t members = std::min(group, count - first);
+			at.assign(members, root);
+
+			/*
+				The tree is height balanced so the group walks down in step.  Once a query has chosen its next node the loads of that
+				node's children are started, then the other queries in the group take their steps while those loads are in flight.
+				As in search(), subtrees that are all tombstoned are skipped
+			*/
+			while (!at[0]->child[0]->isleaf())
+				for (size_t member = 0; member < members; member++)
+					{
+					at[member] = at[member]->child[nearest_live(&counters, at[member], queries[first + member])];
+					at[member]->prefetch_children();
+					}
+
+			/*
+				Now find the closest vectors below the node each query reached
+			*/
+			for (size_t member = 0; member < members; member++)
+				{
+				const node *current = at[member];
+				object *query = queries[first + member];
+				auto &found = results[first + member];
+
+				for (size_t which = 0; which < current->children; which++)
+					if (current->child[which]->dead_below == 0)
+						found.push_back(std::make_pair(query->distance_squared(current->child[which]->centroid), current->child[which]->centroid));
+
+				size_t keep = std::min(k, found.size());
+				std::partial_sort(found.begin(), found.begin() + keep, found.end(), [](const std::pair<float, object *> &a, const std::pair<float, object *> &b) { return a.first < b.first; });
+				found.resize(keep);
+				}
+			}
+		}
+
+	/*
+		K_TREE::GET_EXAMPLE_OBJECT
+		--------------------------
+		Return an example vector
+	*/
+	object *k_tree::get_example_object(void)
+		{
+		return parameters->centroid;
+		}
+
+	/*
+		K_TREE::STATS()
+		---------------
+		Return a snapshot of the instrumentation counters (the tree counters are only kept if K_TREE_STATS is defined)
+	*/
+	statistics k_tree::stats(void) const
+		{
+		statistics answer = tree_context.counters;
+
+		answer.allocator_bytes = memory->bytes_used();
+		answer.allocator_blocks = memory->blocks_used();
+
+		return answer;
+		}
+
+	/*
+		K_TREE::ANALYSE()
+		-----------------
+		Return the shape and quality of the tree (depth, fan-out, fill, sum of squared errors, and centroid drift).  This walks the
+		whole tree, dividing the work between the given number of threads (0 means one per CPU core)
+	*/
+	analysis k_tree::analyse(size_t threads) const
+		{
+		analysis answer;
+
+		answer.analyse(root, parameters->centroid->dimensions, threads);
+
+		return answer;
+		}
+
+	/*
+		K_TREE::TEXT_RENDER()
+		---------------------
+		Serialsise a human-readable version of tree to the stream
+	*/
+	void k_tree::text_render(std::ostream &stream) const
+		{
+		if (root != nullptr)
+			root->text_render(stream);
+		}
+
+	/*
+		TEST_SUMS, TEST_LAZY, TEST_BUFFERS, TEST_PRUNING, TEST_INDEX
+		--------------------------------------------------------------
+		Used by the unit tests.  The insert options a test tree is built with, or-ed together (see test_setup())
+	*/
+	constexpr size_t TEST_SUMS = 1;				// context::running_sums
+	constexpr size_t TEST_LAZY = 2;				// context::lazy_batch of 3
+	constexpr size_t TEST_BUFFERS = 4;			// context::buffer_size (3 unless told otherwise)
+	constexpr size_t TEST_PRUNING = 8;			// context::triangle_pruning
+	constexpr size_t TEST_INDEX = 16;			// context::index_leaves
+
+	/*
+		TEST_SETUP()
+		------------
+		Used by the unit tests.  Set the insert options of tree to those in options (TEST_ flags or-ed together), buffers hold buffer_size
+		vectors
+	*/
+	static void test_setup(k_tree &tree, size_t options, size_t buffer_size = 3)
+		{
+		tree.tree_context.running_sums = (options & TEST_SUMS) != 0;
+		tree.tree_context.lazy_batch = (options & TEST_LAZY) != 0 ? 3 : 0;
+		tree.tree_context.buffer_size = (options & TEST_BUFFERS) != 0 ? buffer_size : 0;
+		tree.tree_context.triangle_pruning = (options & TEST_PRUNING) != 0;
+		tree.tree_context.index_leaves = (options & TEST_INDEX) != 0;
+		}
+
+	/*
+		TEST_FILL()
+		-----------
+		Used by the unit tests.  Add each of data to tree repeats times, one at a time or (if batched) with push_back_batch()
+	*/
+	static void test_fill(allocator *memory, k_tree &tree, const std::vector<object *> &data, size_t repeats = 1, bool batched = false)
+		{
+		for (size_t repeat = 0; repeat < repeats; repeat++)
+			if (batched)
+				tree.push_back_batch(memory, &data[0], data.size());
+			else
+				for (const auto vector : data)
+					tree.push_back(memory, vector);
+		}
+
+	/*
+		TEST_SHAPE()
+		------------
+		Used by the unit tests.  Empty the buffers and apply the deferred centroid updates of tree, then return its analysis
+	*/
+	static analysis test_shape(allocator *memory, k_tree &tree)
+		{
+		tree.flush_buffers(memory);
+		tree.refresh_centroids();
+		return tree.analyse(1);
+		}
+
+	/*
+		TEST_COPIES()
+		-------------
+		Used by the unit tests.  Return a new copy of each of data, so that the copies can be changed, erased, or reused
+	*/
+	static std::vector<object *> test_copies(allocator *memory, const std::vector<object *> &data)
+		{
+		std::vector<object *> answer;
+
+		for (const auto vector : data)
+			{
+			answer.push_back(vector->new_object(memory));
+			*answer.back() = *vector;
+			}
+
+		return answer;
+		}
+
+	/*
+		WELL_FORMED()
+		-------------
+		Used by the unit tests.  Returns whether or not the analysis of a tree shows that it holds vectors vectors with every count
+		right, no node empty or with more than max_fanout children, and every centroid within max_drift of the mean of the
+		vectors below it
+	*/
+	[[maybe_unused]] static bool well_formed(const analysis &shape, size_t vectors, size_t max_fanout = SIZE_MAX, double max_drift = 0.0001)
+		{
+		if (shape.vectors != vectors || shape.count_mismatches != 0)
+			return false;
+
+		for (const auto &level : shape.levels)
+			if (level.min_fanout == 0 || level.max_fanout > max_fanout || level.max_drift >= max_drift)
+				return false;
+
+		return true;
+		}
+
+	/*
+		TEST_SEARCH()
+		-------------
+		Test search() and search_batch() on tree, which holds data_list
+	*/
+	static void test_search(const k_tree &tree, const std::vector<object *> &data_list)
+		{
+		/*
+			The closest vector to each vector is itself, and an exhaustive beam finds the true nearest neighbours
+		*/
+		std::vector<std::pair<float, object *>> found;
+		tree.search(found, data_list[3], 1, 1);
+		assert(found.size() == 1 && found[0].first == 0);
+
+		std::vector<float> truth;
+		for (const auto data : data_list)
+			truth.push_back(data_list[0]->distance_squared(data));
+		std::sort(truth.begin(), truth.end());
+		for (size_t k : {(size_t)5, data_list.size()})
+			{
+			tree.search(found, data_list[0], k, data_list.size());
+			assert(found.size() == k);
+			for (size_t which = 0; which < k; which++)
+				assert(found[which].first == truth[which] && std::find(data_list.begin(), data_list.end(), found[which].second) != data_list.end());
+			}
+
+		/*
+			Interleaved search finds what a search with a beam of 1 finds, whatever the group size
+		*/
+		std::vector<std::vector<std::pair<float, object *>>> found_batch;
+		for (size_t group = 1; group <= data_list.size() + 1; group += 3)
+			{
+			tree.search_batch(found_batch, &data_list[0], data_list.size(), 3, group);
+			assert(found_batch.size() == data_list.size());
+			for (size_t which = 0; which < data_list.size(); which++)
+				{
+				tree.search(found, data_list[which], 3, 1);
+				assert(found_batch[which].size() == found.size());
+				for (size_t neighbour = 0; neighbour < found.size(); neighbour++)
+					assert(found_batch[which][neighbour].first == found[neighbour].first);
+				}
+			}
+		}
+
+	/*
+		TEST_TRIANGLE_PRUNING()
+		-----------------------
+		Triangle pruning must not change the tree, unpruned is the tree data_list was added to without it
+	*/
+	static void test_triangle_pruning(allocator *memory, const k_tree &unpruned, const std::vector<object *> &data_list)
+		{
+		k_tree pruned(memory, 4, data_list[0]->dimensions);
+		test_setup(pruned, TEST_PRUNING);
+		test_fill(memory, pruned, data_list);
+		std::ostringstream with_pruning;
+		std::ostringstream without_pruning;
+		with_pruning << pruned;
+		without_pruning << unpruned;
+		assert(with_pruning.str() == without_pruning.str());
+		}
+
+	/*
+		TEST_SPLIT()
+		------------
+		Every way of splitting a node must produce valid trees
+	*/
+	static void test_split(allocator *memory, const std::vector<object *> &data_list)
+		{
+		size_t dimensions = data_list[0]->dimensions;
+
+		/*
+			Bounded and capped k-means
+		*/
+		for (size_t cap = 0; cap < 2; cap++)
+			{
+			k_tree bounded(memory, 4, dimensions);
+			bounded.tree_context.split_bounds = true;
+			bounded.tree_context.split_max_iterations = cap;
+			test_fill(memory, bounded, data_list);
+			assert(well_formed(bounded.analyse(1), data_list.size()));
+#ifdef K_TREE_STATS
+			assert(cap == 0 || bounded.stats().max_split_iterations <= cap);
+#endif
+
+			/*
+				Identical vectors, where every distance is a tie
+			*/
+			k_tree same(memory, 4, dimensions);
+			same.tree_context.split_bounds = true;
+			same.tree_context.split_max_iterations = cap;
+			for (size_t copy = 0; copy < data_list.size(); copy++)
+				same.push_back(memory, data_list[0]);
+			assert(well_formed(same.analyse(1), data_list.size()));
+			assert(same.root->centroid->distance_squared(data_list[0]) < 0.0001);
+			}
+
+		/*
+			Clustering a sample of the children
+		*/
+		k_tree sampled(memory, 4, dimensions);
+		sampled.tree_context.split_sample = 3;
+		test_fill(memory, sampled, data_list);
+		assert(well_formed(sampled.analyse(1), data_list.size()));
+#ifdef K_TREE_STATS
+		assert(sampled.stats().sampled_splits == sampled.stats().splits);
+#endif
+
+		/*
+			Every split strategy (the data is in two well separated groups, so each should find them)
+		*/
+		const char *strategies[] = {"closest", "farthest", "kmeans++", "pddp"};
+		for (const char *name : strategies)
+			{
+			k_tree strategy(memory, 4, dimensions);
+			if (context::split_strategy_of(name, strategy.tree_context.split_method))		// an unknown name leaves the tree empty
+				test_fill(memory, strategy, data_list);
+			assert(well_formed(strategy.analyse(1), data_list.size()));
+			}
+		assert(!context::split_strategy_of("unknown", sampled.tree_context.split_method));
+
+		/*
+			Multi-way splits: no node may overflow, whatever the order and the number of ways
+		*/
+		for (size_t ways = 3; ways <= 5; ways++)
+			{
+			k_tree multi_way(memory, 5, dimensions);
+			multi_way.tree_context.split_ways = ways;
+			test_fill(memory, multi_way, data_list, 4);
+			analysis multi_way_shape = multi_way.analyse(1);
+			assert(well_formed(multi_way_shape, 4 * data_list.size(), 5));
+			assert(multi_way_shape.levels[multi_way_shape.depth - 1].nodes == 1);
+			}
+		}
+
+	/*
+		TEST_RUNNING_SUMS()
+		-------------------
+		Running sums: the same tree shape, and the centroids are the means of the vectors below them
+	*/
+	static void test_running_sums(allocator *memory, const std::vector<object *> &data_list)
+		{
+		for (size_t ways = 2; ways <= 3; ways++)
+			{
+			k_tree summed(memory, 4, data_list[0]->dimensions);
+			test_setup(summed, TEST_SUMS);
+			summed.tree_context.split_ways = ways;
+			test_fill(memory, summed, data_list, 4);
+			assert(well_formed(summed.analyse(1), 4 * data_list.size(), 4));
+			}
+		}
+
+	/*
+		TEST_ORDERS()
+		-------------
+		Separate leaf and internal orders
+	*/
+	static void test_orders(allocator *memory, const std::vector<object *> &data_list)
+		{
+		for (size_t ways = 2; ways <= 3; ways++)
+			{
+			k_tree wide_leaves(memory, 8, 3, data_list[0]->dimensions);
+			wide_leaves.tree_context.split_ways = ways;
+			test_fill(memory, wide_leaves, data_list, 4);
+			analysis wide_leaves_shape = wide_leaves.analyse(1);
+			assert(well_formed(wide_leaves_shape, 4 * data_list.size(), 8));
+			assert(wide_leaves_shape.depth >= 3);
+			assert(wide_leaves_shape.levels[0].max_fanout <= 8);
+			for (size_t level = 1; level < wide_leaves_shape.depth; level++)
+				assert(wide_leaves_shape.levels[level].max_fanout <= 3);
+			}
+		}
+
+	/*
+		TEST_LAZY_CENTROIDS()
+		---------------------
+		Lazy centroids: once refreshed the centroids are the means of the vectors below them.  With triangle pruning the tree must be
+		the same as without, as pruning only skips children that cannot be the closest
+	*/
+	static void test_lazy_centroids(allocator *memory, const std::vector<object *> &data_list)
+		{
+		for (size_t options : {TEST_LAZY, TEST_LAZY | TEST_SUMS})
+			{
+			k_tree lazy(memory, 4, data_list[0]->dimensions);
+			k_tree pruned_lazy(memory, 4, data_list[0]->dimensions);
+			test_setup(lazy, options);
+			test_setup(pruned_lazy, options | TEST_PRUNING);
+			for (size_t repeat = 0; repeat < 4; repeat++)
+				for (const auto data : data_list)
+					{
+					lazy.push_back(memory, data);
+					pruned_lazy.push_back(memory, data);
+					}
+			analysis lazy_shape = test_shape(memory, lazy);
+			analysis pruned_lazy_shape = test_shape(memory, pruned_lazy);
+			assert(well_formed(lazy_shape, 4 * data_list.size(), 4) && well_formed(pruned_lazy_shape, 4 * data_list.size(), 4));
+			assert(pruned_lazy_shape.nodes == lazy_shape.nodes && pruned_lazy_shape.sum_squared_error() == lazy_shape.sum_squared_error());
+#ifdef K_TREE_STATS
+			assert(lazy.stats().centroid_refreshes > 0);
+#endif
+			}
+		}
+
+	/*
+		TEST_BATCHES()
+		--------------
+		Batch insertion with and without running sums and lazy centroids, and buffered insertion: once flushed, every vector is in the
+		tree exactly once
+	*/
+	static void test_batches(allocator *memory, const std::vector<object *> &data_list)
+		{
+		for (size_t options : {TEST_PRUNING, TEST_SUMS, TEST_LAZY, TEST_SUMS | TEST_LAZY})
+			{
+			k_tree batched(memory, 4, data_list[0]->dimensions);
+			test_setup(batched, options);
+			test_fill(memory, batched, data_list, 4, true);
+			assert(well_formed(test_shape(memory, batched), 4 * data_list.size(), 4));
+			}
+
+		for (size_t options : {TEST_BUFFERS | TEST_PRUNING, TEST_BUFFERS | TEST_SUMS})
+			for (bool batches : {false, true})
+				{
+				k_tree buffered(memory, 4, data_list[0]->dimensions);
+				test_setup(buffered, options);
+				test_fill(memory, buffered, data_list, 4, batches);
+				analysis buffered_shape = test_shape(memory, buffered);
+				assert(well_formed(buffered_shape, 4 * data_list.size(), 4));
+				assert(buffered_shape.depth >= 3);
+#ifdef K_TREE_STATS
+				assert(buffered.stats().buffer_flushes > 0);
+#endif
+				}
+		}
+
+	/*
+		TEST_SPLIT_BUDGET()
+		-------------------
+		A split budget: nodes may wait over-full (but never beyond their capacity), and finish_splits() splits them
+	*/
+	static void test_split_budget(allocator *memory, const std::vector<object *> &data_list)
+		{
+		for (size_t options : {TEST_PRUNING, TEST_SUMS, TEST_BUFFERS})
+			{
+			k_tree budgeted(memory, 4, data_list[0]->dimensions);
+			test_setup(budgeted, options);
+			budgeted.tree_context.split_budget = 1;
+			budgeted.tree_context.overflow_slack = 3;
+			test_fill(memory, budgeted, data_list, 4);
+			assert(well_formed(test_shape(memory, budgeted), 4 * data_list.size(), 4 + 1 + 3));
+
+			budgeted.finish_splits(memory);
+			assert(well_formed(test_shape(memory, budgeted), 4 * data_list.size(), 4));
+			}
+		}
+
+	/*
+		TEST_ERASE()
+		------------
+		Erase: the tree stays valid (and its centroids the means of the vectors below them) as the vectors are removed one by one,
+		then is empty and can be used again
+	*/
+	static void test_erase(allocator *memory, const std::vector<object *> &data_list)
+		{
+		for (size_t index : {(size_t)0, TEST_INDEX})
+			for (size_t options : {TEST_PRUNING, TEST_SUMS, TEST_LAZY, TEST_BUFFERS})
+				{
+				k_tree erased(memory, 4, data_list[0]->dimensions);
+				test_setup(erased, options | index);
+				erased.tree_context.min_fill = 0.5;
+				test_fill(memory, erased, data_list);
+
+				for (size_t which = 0; which < data_list.size(); which++)
+					{
+					assert(erased.erase(memory, data_list[(which * 5) % data_list.size()]));
+					assert(!erased.erase(memory, data_list[(which * 5) % data_list.size()]));
+					erased.refresh_centroids();
+					assert(well_formed(erased.analyse(1), data_list.size() - which - 1, 4));
+					}
+				assert(erased.root == nullptr);
+
+				test_fill(memory, erased, data_list);
+				assert(test_shape(memory, erased).vectors == data_list.size());
+				}
+
+		/*
+			With separate leaf and internal orders, so a node directly above the vectors needs more children than its parent
+		*/
+		for (size_t options : {(size_t)0, TEST_SUMS})
+			{
+			k_tree narrow(memory, 8, 2, data_list[0]->dimensions);
+			test_setup(narrow, options);
+			narrow.tree_context.min_fill = 0.5;
+			std::vector<object *> copies;
+			for (size_t copy = 0; copy < 4; copy++)
+				for (const auto data : test_copies(memory, data_list))
+					{
+					data->vector[1] += (float)0.01 * copy;
+					copies.push_back(data);
+					narrow.push_back(memory, data);
+					}
+
+			for (size_t which = 0; which < copies.size(); which++)
+				{
+				assert(narrow.erase(memory, copies[(which * 5) % copies.size()]));
+				assert(well_formed(narrow.analyse(1), copies.size() - which - 1, 8));
+				}
+			assert(narrow.root == nullptr);
+			}
+		}
+
+	/*
+		TEST_TOMBSTONE()
+		----------------
+		Tombstones: deleted vectors are not found by search but stay in the tree until compacted
+	*/
+	static void test_tombstone(allocator *memory, const std::vector<object *> &data_list)
+		{
+		std::vector<std::pair<float, object *>> found;
+		std::vector<std::vector<std::pair<float, object *>>> found_batch;
+
+		for (size_t options : {(size_t)0, TEST_INDEX})
+			{
+			k_tree dead(memory, 4, data_list[0]->dimensions);
+			test_setup(dead, options);
+			dead.tree_context.dead_fraction = 1.0;
+			test_fill(memory, dead, data_list);
+
+			for (size_t which = 0; which < 3; which++)
+				assert(dead.tombstone(memory, data_list[which * 5]));
+			assert(!dead.tombstone(memory, data_list[5]));
+			dead.search(found, data_list[0], data_list.size(), data_list.size());
+			assert(found.size() == data_list.size() - 3);
+			assert(std::none_of(found.begin(), found.end(), [&](const std::pair<float, object *> &neighbour) { return neighbour.second == data_list[0] || neighbour.second == data_list[5] || neighbour.second == data_list[10]; }));
+			dead.search_batch(found_batch, &data_list[0], 1, 1);
+			assert(found_batch[0].size() == 1 && found_batch[0][0].second != data_list[0]);
+			assert(dead.analyse(1).vectors == data_list.size());
+
+			dead.compact(memory);
+			assert(well_formed(dead.analyse(1), data_list.size() - 3, 4));
+			assert(dead.root->dead_below == 0);
+
+			/*
+				Compaction as the vectors are deleted
+			*/
+			dead.tree_context.dead_fraction = 0.25;
+			for (const auto data : data_list)
+				dead.tombstone(memory, data);
+			assert(dead.root == nullptr || dead.root->dead_below <= dead.root->leaves_below_this_point / 4);
+			dead.compact(memory);
+			assert(dead.root == nullptr);
+
+			/*
+				A batched search must not walk into a subtree that is all tombstoned
+			*/
+			dead.tree_context.dead_fraction = 1.0;
+			test_fill(memory, dead, data_list);
+			for (size_t which = 1; which < data_list.size(); which++)
+				dead.tombstone(memory, data_list[which]);
+			dead.search_batch(found_batch, &data_list[0], data_list.size(), 1);
+			assert(std::all_of(found_batch.begin(), found_batch.end(), [&](const std::vector<std::pair<float, object *>> &one) { return one.size() == 1 && one[0].second == data_list[0]; }));
+			}
+		}
+
+	/*
+		TEST_UPDATE()
+		-------------
+		Update: vectors that barely move stay where they are, vectors that move to the other cluster are moved, and either way the
+		centroids stay the means of the vectors below them
+	*/
+	static void test_update(allocator *memory, const std::vector<object *> &data_list)
+		{
+		std::vector<std::pair<float, object *>> found;
+
+		for (size_t options : {TEST_PRUNING, TEST_SUMS, TEST_INDEX})
+			{
+			k_tree moving(memory, 4, data_list[0]->dimensions);
+			test_setup(moving, options);
+			std::vector<object *> copies = test_copies(memory, data_list);
+			test_fill(memory, moving, copies);
+
+			object *new_vector = data_list[0]->new_object(memory);
+			for (size_t which = 0; which < copies.size(); which++)
+				{
+				*new_vector = *data_list[(which + 8) % data_list.size()];
+				if (which % 2 == 0)
+					*new_vector = *copies[which];
+				new_vector->vector[0] += (float)0.01;
+				assert(moving.update(memory, copies[which], new_vector));
+
+				assert(well_formed(moving.analyse(1), data_list.size(), 4));
+				moving.search(found, new_vector, 1, data_list.size());
+				assert(found[0].first == 0);
+				}
+#ifdef K_TREE_STATS
+			assert(moving.stats().updates == data_list.size());
+			assert(moving.stats().relocations > 0 && moving.stats().relocations < data_list.size());
+#endif
+			}
+		}
+
+	/*
+		TEST_WINDOW()
+		-------------
+		Sliding window: add the vectors once per time step and keep the last two steps.  The tree holds exactly the vectors in the
+		window, and once the window is full the expired vectors and the nodes freed are reused so the memory used stops growing
+	*/
+	static void test_window(const std::vector<object *> &data_list)
+		{
+		std::vector<std::pair<float, object *>> found;
+
+		for (size_t options : {(size_t)0, TEST_INDEX})
+			{
+			allocator window_memory(1024 * 1024);
+			k_tree windowed(&window_memory, 4, data_list[0]->dimensions);
+			test_setup(windowed, options);
+			std::vector<object *> spare;
+			size_t bytes_when_full = 0;
+			for (uint64_t now = 0; now < 40; now++)
+				{
+				for (const auto data : data_list)
+					{
+					object *copy;
+					if (spare.empty())
+						copy = data->new_object(&window_memory);
+					else
+						{
+						copy = spare.back();
+						spare.pop_back();
+						}
+					*copy = *data;
+					copy->vector[0] += (float)now;
+					windowed.push_back(&window_memory, copy, now);
+					}
+
+				size_t removed = windowed.expire(&window_memory, now < 1 ? 0 : now - 1, &spare);
+				assert(removed == (now < 2 ? 0 : data_list.size()));
+				assert(removed == spare.size());
+				(void)removed;
+
+				assert(well_formed(windowed.analyse(1), std::min((size_t)now + 1, (size_t)2) * data_list.size(), 4));
+				windowed.search(found, data_list[0], 1, data_list.size());
+				assert(found[0].second->vector[0] >= (float)now - 1);
+
+				if (now == 20)
+					bytes_when_full = window_memory.bytes_used();
+				}
+			assert(window_memory.bytes_used() == bytes_when_full);
+			(void)bytes_when_full;
+			}
+		}
+
+	/*
+		TEST_MICRO_CLUSTERS()
+		---------------------
+		Micro-clusters: each vector is added three times, moved a little each time.  The copies are absorbed into one leaf, yet the
+		counts and the sum of squared errors at the root are the same as those of a tree holding every vector, and the vector passed
+		to push_back() can be reused at once.  With a budget the radius grows so that the tree holds no more leaves than the budget
+	*/
+	static void test_micro_clusters(allocator *memory, const std::vector<object *> &data_list)
+		{
+		std::vector<std::pair<float, object *>> found;
+
+		for (size_t variant = 0; variant < 4; variant++)
+			{
+			size_t options = variant == 1 ? TEST_SUMS : variant == 2 ? TEST_BUFFERS : 0;
+			k_tree every(memory, 4, data_list[0]->dimensions);
+			k_tree clustered(memory, 4, data_list[0]->dimensions);
+			test_setup(every, options, 4);
+			test_setup(clustered, options, 4);
+			clustered.tree_context.absorb_radius = variant == 3 ? 0.0001 : 0.05;
+			clustered.tree_context.absorb_budget = variant == 3 ? 4 : 0;
+			object *point = data_list[0]->new_object(memory);
+			for (size_t copy = 0; copy < 3; copy++)
+				for (const auto data : data_list)
+					{
+					if (variant == 2)
+						point = data->new_object(memory);		// a buffer holds the vector itself until it is passed down
+					*point = *data;
+					point->vector[0] += (float)0.01 * copy - (float)0.01;
+					clustered.push_back(memory, point);
+
+					object *kept = data->new_object(memory);
+					*kept = *point;
+					every.push_back(memory, kept);
+					}
+
+			analysis clustered_shape = test_shape(memory, clustered);
+			analysis every_shape = test_shape(memory, every);
+			assert(well_formed(clustered_shape, 3 * data_list.size(), 4) && every_shape.vectors == 3 * data_list.size());
+			assert(fabs(clustered_shape.levels.back().sum_squared_error - every_shape.levels.back().sum_squared_error) < 0.001 * every_shape.levels.back().sum_squared_error);
+			if (variant == 3)
+				assert(clustered.tree_context.micro_clusters <= 4 && clustered.tree_context.absorb_radius > 0.0001);
+			else
+				assert(clustered.tree_context.micro_clusters <= data_list.size());
+			clustered.search(found, data_list[0], 1, data_list.size());
+			assert(found[0].second != point && (variant == 3 || found[0].first < 0.0001));
+#ifdef K_TREE_STATS
+			assert(clustered.stats().absorbs == 3 * data_list.size() - clustered.tree_context.micro_clusters);
+#endif
+
+			/*
+				A sliding window needs the vectors themselves, which micro-clusters do not keep
+			*/
+			assert(!clustered.push_back(memory, point, 0));
+			assert(clustered.expire(memory, 1) == 0 && clustered.analyse(1).vectors == 3 * data_list.size());
+			}
+		}
+
+	/*
+		TEST_WEIGHTS()
+		--------------
+		Weighted vectors: a vector of weight w is counted as w copies of it, so the tree has the same counts, centroids, and sum of
+		squared errors at the root as a tree holding every copy.  Erase, tombstone, and update take the whole weight with them
+	*/
+	static void test_weights(allocator *memory, const std::vector<object *> &data_list)
+		{
+		std::vector<std::pair<float, object *>> found;
+
+		for (size_t options : {(size_t)0, TEST_SUMS, TEST_LAZY, TEST_BUFFERS})
+			{
+			k_tree weighted(memory, 4, data_list[0]->dimensions);
+			k_tree copied(memory, 4, data_list[0]->dimensions);
+			test_setup(weighted, options | TEST_INDEX, 4);
+			test_setup(copied, options, 4);
+			size_t total_weight = 0;
+			for (size_t which = 0; which < data_list.size(); which++)
+				{
+				size_t weight = which % 3 + 1;
+				weighted.push_back_weighted(memory, data_list[which], weight);
+				for (size_t copy = 0; copy < weight; copy++)
+					copied.push_back(memory, data_list[which]);
+				total_weight += weight;
+				}
+
+			analysis weighted_shape = test_shape(memory, weighted);
+			analysis copied_shape = test_shape(memory, copied);
+			assert(well_formed(weighted_shape, total_weight, 4) && copied_shape.vectors == total_weight);
+			assert(weighted.root->centroid->distance_squared(copied.root->centroid) < 0.0001);
+			assert(fabs(weighted_shape.levels.back().sum_squared_error - copied_shape.levels.back().sum_squared_error) < 0.001 * copied_shape.levels.back().sum_squared_error);
+
+			/*
+				data_list[2] has weight 3, data_list[4] weight 2, and data_list[6] weight 1
+			*/
+			assert(weighted.erase(memory, data_list[2]));
+			assert(weighted.tombstone(memory, data_list[4]));
+			weighted.search(found, data_list[4], data_list.size(), data_list.size());
+			assert(std::none_of(found.begin(), found.end(), [&](const std::pair<float, object *> &neighbour) { return neighbour.second == data_list[2] || neighbour.second == data_list[4]; }));
+			object *moved = data_list[6]->new_object(memory);
+			*moved = *data_list[6];
+			moved->vector[0] += (float)0.01;
+			assert(weighted.update(memory, data_list[6], moved));
+			moved->vector[0] -= (float)0.01;
+			assert(weighted.update(memory, data_list[6], moved));		// put it back as the other trees hold it too
+			weighted.compact(memory);
+			assert(well_formed(weighted.analyse(1), total_weight - 5, 4));
+			}
+		}
+
+	/*
+		TEST_DUPLICATES()
+		-----------------
+		Duplicate collapsing: a vector with the same bits as one already in the tree (even as a different object) adds to that leaf's
+		count, so the tree has one leaf for each distinct vector but the same counts, centroids, and sum of squared errors as a tree
+		holding every copy.  Erase takes every copy with it.  Some of data_list are already the same as each other
+	*/
+	static void test_duplicates(allocator *memory, const std::vector<object *> &data_list)
+		{
+		std::unordered_map<object *, size_t, object_bits, object_bits> copies_of;
+		for (const auto data : data_list)
+			copies_of[data]++;
+
+		for (size_t options : {(size_t)0, TEST_SUMS, TEST_LAZY, TEST_BUFFERS, TEST_PRUNING})
+			{
+			k_tree collapsed(memory, 4, data_list[0]->dimensions);
+			k_tree copied(memory, 4, data_list[0]->dimensions);
+			test_setup(collapsed, options, 4);
+			test_setup(copied, options, 4);
+			collapsed.tree_context.collapse_duplicates = true;
+			for (size_t round = 0; round < 3; round++)
+				{
+				std::vector<object *> copies = test_copies(memory, data_list);
+				test_fill(memory, copied, data_list);
+				std::vector<object *> reusable;
+				if (round == 0)
+					{
+					/*
+						Only a vector with the same bits as one before it in data_list is collapsed
+					*/
+					for (const auto data : data_list)
+						{
+						if (!collapsed.push_back(memory, data))
+							reusable.push_back(data);
+						collapsed.flush_buffers(memory);		// a vector waiting in a buffer does not yet have a leaf for its copies to find
+						}
+					assert(reusable.size() == data_list.size() - copies_of.size());
+					assert(std::all_of(reusable.begin(), reusable.end(), [&](object *repeat) { auto at = std::find(data_list.begin(), data_list.end(), repeat); return std::find_if(data_list.begin(), at, [&](object *earlier) { return object_bits()(earlier, repeat); }) != at; }));
+					}
+				else
+					{
+					if (options == TEST_BUFFERS)
+						{
+						size_t kept = collapsed.push_back_batch(memory, &copies[0], copies.size(), &reusable);
+						assert(kept == 0);
+						(void)kept;
+						}
+					else
+						for (const auto data : copies)
+							if (!collapsed.push_back(memory, data))
+								reusable.push_back(data);
+					assert(reusable == copies);
+					}
+				}
+
+			analysis collapsed_shape = test_shape(memory, collapsed);
+			analysis copied_shape = test_shape(memory, copied);
+			assert(well_formed(collapsed_shape, 3 * data_list.size(), 4) && copied_shape.vectors == 3 * data_list.size());
+			assert(collapsed_shape.levels[0].children == copies_of.size() && collapsed.tree_context.leaf_with.size() == copies_of.size());
+			assert(collapsed.root->centroid->distance_squared(copied.root->centroid) < 0.0001);
+			assert(fabs(collapsed_shape.levels.back().sum_squared_error - copied_shape.levels.back().sum_squared_error) < 0.001 * copied_shape.levels.back().sum_squared_error);
+#ifdef K_TREE_STATS
+			assert(collapsed.stats().duplicates == 3 * data_list.size() - copies_of.size() && collapsed.stats().inserts == 3 * data_list.size());
+#endif
+
+			assert(collapsed.erase(memory, data_list[0]));
+			assert(collapsed.tree_context.leaf_with.size() == copies_of.size() - 1);
+			assert(collapsed.analyse(1).vectors == 3 * data_list.size() - 3 * copies_of[data_list[0]]);
+			object *again = data_list[0]->new_object(memory);
+			*again = *data_list[0];
+			assert(collapsed.push_back(memory, again));
+			collapsed.flush_buffers(memory);
+			assert(!collapsed.push_back(memory, data_list[0]));
+			assert(well_formed(test_shape(memory, collapsed), 3 * data_list.size() - 3 * copies_of[data_list[0]] + 2, 4));
+			}
+
+		/*
+			Vectors added with a timestamp and vectors moved by update() are never collapsed, even when they reach the tree through a
+			buffer, as expire() and erase() look for the object itself
+		*/
+		for (size_t options : {(size_t)0, TEST_BUFFERS})
+			{
+			k_tree stream(memory, 4, data_list[0]->dimensions);
+			test_setup(stream, options, 4);
+			stream.tree_context.collapse_duplicates = true;
+			for (uint64_t now = 0; now < 40; now++)
+				{
+				object *copy = data_list[0]->new_object(memory);
+				*copy = *data_list[now % 5];
+				stream.push_back(memory, copy, now);
+				}
+			assert(stream.expire(memory, 40) == 40 && stream.root == nullptr);
+
+			std::vector<object *> copies = test_copies(memory, data_list);
+			test_fill(memory, stream, copies);
+			stream.flush_buffers(memory);
+			assert(stream.update(memory, copies[0], data_list[data_list.size() - 1]));
+			assert(stream.erase(memory, copies[0]));
+			assert(stream.erase(memory, copies[data_list.size() - 1]));
+			}
+		}
+
+	/*
+		K_TREE::UNITTEST()
+		------------------
+		Test the class
+	*/
+	void k_tree::unittest(void)
+		{
+		constexpr size_t dimensions = 2;
+		object initial(dimensions);
+		allocator memory;
+		k_tree tree(&memory, 4, dimensions);
+		size_t total_adds = 16;
+		std::vector<object *> data_list;
+
+		for (size_t which = 0; which < total_adds; which++)
+			{
+			object &data = *initial.new_object(&memory);
+			for (size_t dimension = 0; dimension < initial.dimensions; dimension++)
+				if (which < 8)
+					data.vector[dimension] = (rand() % 20) / (float)10.0;
+				else
+					data.vector[dimension] = ((rand() % 20) + 70) / (float)10.0;
+
+			data_list.push_back(&data);
+std::cout << "-----------> " << data << "\n";
+			tree.push_back(&memory, &data);
+std::cout << tree << "\n";
+			}
+
+std::cout << "TREE (" << total_adds << " adds)\n";
+std::cout << tree;
+
+		/*
+			Check the instrumentation
+		*/
+		statistics counters = tree.stats();
+		assert(counters.allocator_bytes > 0);
+		assert(counters.allocator_blocks == 1);
+#ifdef K_TREE_STATS
+		assert(counters.inserts == total_adds);
+		assert(counters.splits > 0);
+		assert(counters.splits_per_level[0] > 0);
+		assert(counters.split_iterations >= 2 * counters.splits);
+		assert(counters.nodes_visited >= total_adds - 1);
+		assert(counters.compute_mean_calls >= 2 * counters.splits);
+#endif
+		(void)counters;
+
+		/*
+			Check the analysis, the answer must not depend on the number of threads
+		*/
+		analysis shape = tree.analyse(1);
+		analysis parallel_shape = tree.analyse(4);
+		assert(shape.vectors == total_adds);
+		assert(shape.depth == 2);
+		assert(shape.count_mismatches == 0);
+		assert(shape.levels[1].nodes == 1);
+		assert(shape.levels[0].children == total_adds);
+		assert(shape.levels[0].max_drift < 0.0001);
+		assert(parallel_shape.nodes == shape.nodes);
+		assert(fabs(parallel_shape.sum_squared_error() - shape.sum_squared_error()) < 0.0001);
+		assert(shape.distortion() <= shape.levels[1].sum_squared_error);
+
+		/*
+			Then each feature in turn
+		*/
+		test_search(tree, data_list);
+		test_triangle_pruning(&memory, tree, data_list);
+		test_split(&memory, data_list);
+		test_running_sums(&memory, data_list);
+		test_orders(&memory, data_list);
+		test_lazy_centroids(&memory, data_list);
+		test_batches(&memory, data_list);
+		test_split_budget(&memory, data_list);
+		test_erase(&memory, data_list);
+		test_tombstone(&memory, data_list);
+		test_update(&memory, data_list);
+		test_window(data_list);
+		test_micro_clusters(&memory, data_list);
+		test_weights(&memory, data_list);
+		test_duplicates(&memory, data_list);
+
+		puts("k_tree::PASS\n");
 		}
 	}
@@ -8,7 +8,14 @@
 
 #include <stdint.h>
 
+#include <deque>
+#include <vector>
+#include <utility>
+
 #include "node.h"
+#include "context.h"
+#include "analysis.h"
+#include "statistics.h"
 
 namespace k_tree
 	{
@@ -26,23 +33,224 @@ namespace k_tree
 		{
 		public:
 			node *parameters;				// The sole purpose of parameters is to store the order (branchine factor) of the tree and the width of the vectors it holds.
+			node *internal_parameters;	// As parameters, but with the order of the internal nodes (those whose children are nodes rather than vectors)
 			node *root;						// the root of the k-tree
 			allocator *memory;			// all memory allocation happens through this allocator
+			context tree_context;		// the state shared by all the nodes in the tree
+			std::deque<std::pair<uint64_t, object *>> window;	// the vectors added with a timestamp, oldest first (see expire())
+
+		private:
+			/*
+				K_TREE::NEW_ROOT()
+				------------------
+				The root has split so create a new root consisting of the nodes the old root was split into
+			*/
+			void new_root(allocator *memory, const std::vector<node *> &replacement);
+
+			/*
+				K_TREE::ADD_BATCH()
+				-------------------
+				Add the vectors in batch to the (non-empty) tree, emptying batch
+			*/
+			void add_batch(allocator *memory, std::vector<object *> &batch);
+
+			/*
+				K_TREE::ROUTE_BATCH()
+				---------------------
+				Add the vectors in batch to the tree (which may be empty) as new leaves, with no check for duplicates, emptying batch
+			*/
+			void route_batch(allocator *memory, std::vector<object *> &batch);
+
+			/*
+				K_TREE::FIND()
+				--------------
+				Put the path from the root to the leaf holding data in path.  Returns whether or not data is in the tree
+			*/
+			bool find(allocator *memory, object *data, std::vector<path_step> &path);
+
+			/*
+				K_TREE::PATH_TO()
+				-----------------
+				Put the path from the root to the given leaf in path by following the parents up from the leaf
+			*/
+			void path_to(node *leaf, std::vector<path_step> &path);
+
+			/*
+				K_TREE::REMOVE()
+				----------------
+				Remove the leaf at the end of path from the tree, merging or refilling nodes left with too few children
+			*/
+			void remove(allocator *memory, std::vector<path_step> &path);
+
+			/*
+				K_TREE::MARK_DEAD()
+				-------------------
+				Mark data as deleted in the leaf holding it and the nodes above it, leaving the path to it in context::path.  Returns
+				whether or not data was in the tree (and not already deleted)
+			*/
+			bool mark_dead(allocator *memory, object *data);
+
+			/*
+				K_TREE::INSERT()
+				----------------
+				Add data to the tree as weight vectors, giving it a leaf of its own (see push_back_weighted())
+			*/
+			void insert(allocator *memory, object *data, size_t weight);
+
+			/*
+				K_TREE::ADD_TO_DUPLICATE()
+				--------------------------
+				If a live leaf holds a vector with the same bits as data then add weight to its count and to the nodes above it.
+				Returns whether or not it did (see context::collapse_duplicates)
+			*/
+			bool add_to_duplicate(allocator *memory, object *data, size_t weight);
+
+			/*
+				K_TREE::NEAREST_LIVE()
+				----------------------
+				Return the index of the child of current closest to query that is not all tombstoned.  current must itself not be all
+				tombstoned.  The distances computed are added to counters
+			*/
+			static size_t nearest_live(statistics *counters, const node *current, object *query);
 
 		public:
 			/*
 				K_TREE::K_TREE()
 				----------------
-				Constructor
+				Constructor, every node has the same order
 			*/
 			k_tree(allocator *memory, size_t tree_order, size_t vector_order);
 
+			/*
+				K_TREE::K_TREE()
+				----------------
+				Constructor, the nodes directly above the vectors (which are scanned) have order leaf_order and the nodes above them
+				(which are routed through) have order internal_order
+			*/
+			k_tree(allocator *memory, size_t leaf_order, size_t internal_order, size_t vector_order);
+
+			/*
+				K_TREE::PUSH_BACK()
+				-------------------
+				Add to the tree.  Returns whether or not the tree holds data, which it does not if it was added to the count of an
+				identical vector (see context::collapse_duplicates), in which case the caller may reuse data
+			*/
+			bool push_back(allocator *memory, object *data);
+
+			/*
+				K_TREE::PUSH_BACK_WEIGHTED()
+				----------------------------
+				Add to the tree as weight identical vectors (such as a vector standing for that many events).  It is held in one leaf
+				but counts as weight vectors in the centroids and counts above it.  Returns whether or not the tree holds data (see
+				push_back())
+			*/
+			bool push_back_weighted(allocator *memory, object *data, size_t weight);
+
 			/*
 				K_TREE::PUSH_BACK()
 				-------------------
-				Add to the tree
+				Add to the tree as part of a sliding window, data is removed by expire() once timestamp falls out of the window.
+				Timestamps must not decrease from one call to the next.  These vectors are never added to the count of an identical
+				vector (see context::collapse_duplicates).  Returns whether or not data was added, which it is not if the leaves are
+				micro-clusters (see context::absorb_radius) as expire() could not then find it
+			*/
+			bool push_back(allocator *memory, object *data, uint64_t timestamp);
+
+			/*
+				K_TREE::PUSH_BACK_BATCH()
+				-------------------------
+				Add data[0..count-1] to the tree, routing them down the tree together (see node::add_batch_to_node()).  With
+				context::collapse_duplicates those with the same bits as a vector already in the tree are added to its count instead,
+				and are appended to collapsed (if given) so the caller can reuse them.  Returns the number of vectors the tree holds
+			*/
+			size_t push_back_batch(allocator *memory, object *const *data, size_t count, std::vector<object *> *collapsed = nullptr);
+
+			/*
+				K_TREE::ERASE()
+				---------------
+				Remove data (the object passed to push_back(), compared by address) from the tree.  Nodes left with too few children are
+				merged with or take children from a sibling (see context::min_fill).  The vector is found through context::leaf_of if
+				context::index_leaves is set (in which case each vector may be added only once), otherwise by searching for it.  Returns
+				whether or not data was in the tree
+			*/
+			bool erase(allocator *memory, object *data);
+
+			/*
+				K_TREE::UPDATE()
+				----------------
+				Change the vector data (compared as in erase()) to the values in new_vector.  If the node above the node holding it would
+				still choose that node for it then it is changed where it is and the centroids above it are moved, otherwise it is
+				taken out and added again.  Returns whether or not data was in the tree (and not deleted)
+			*/
+			bool update(allocator *memory, object *data, object *new_vector);
+
+			/*
+				K_TREE::TOMBSTONE()
+				-------------------
+				Mark data (compared as in erase()) as deleted without taking it out of the tree.  Search skips it, and it stays in the
+				counts and centroids until it is removed by compact().  That happens as soon as more than context::dead_fraction of
+				the vectors below a node on its path are deleted, in which case every deleted vector below that node is removed.
+				Returns whether or not data was in the tree (and not already deleted)
 			*/
-			void push_back(allocator *memory, object *data);
+			bool tombstone(allocator *memory, object *data);
+
+			/*
+				K_TREE::COMPACT()
+				-----------------
+				Remove every tombstoned vector at or below the given node (by default the whole tree)
+			*/
+			void compact(allocator *memory, node *subtree = nullptr);
+
+			/*
+				K_TREE::EXPIRE()
+				----------------
+				Remove every vector added with a timestamp earlier than before (see push_back()).  They are all tombstoned and then
+				removed together by a single compact(), and the nodes freed are reused by later inserts so the memory used by a window
+				of constant size stops growing.  The vectors removed are appended to expired (if given) so the caller can reuse them too.
+				Returns the number of vectors removed.  Set context::index_leaves to avoid searching for each vector
+			*/
+			size_t expire(allocator *memory, uint64_t before, std::vector<object *> *expired = nullptr);
+
+			/*
+				K_TREE::FLUSH_BUFFERS()
+				-----------------------
+				Pass every vector waiting in a buffer down to the nodes directly above the vectors (see context::buffer_size).  Do this
+				before searching or analysing a tree built with buffered insertion
+			*/
+			void flush_buffers(allocator *memory);
+
+			/*
+				K_TREE::FINISH_SPLITS()
+				-----------------------
+				Empty the buffers then split every node that is waiting to be split (see context::split_budget)
+			*/
+			void finish_splits(allocator *memory);
+
+			/*
+				K_TREE::REFRESH_CENTROIDS()
+				---------------------------
+				Apply every deferred centroid update (see context::lazy_batch).  Do this before searching or analysing a tree built with
+				lazy centroids
+			*/
+			void refresh_centroids(void);
+
+			/*
+				K_TREE::SEARCH()
+				----------------
+				Approximate k-nearest neighbour search.  Descend the tree keeping the beam_width nodes closest to the query at each level,
+				then return (in results) the k vectors below those nodes that are closest to the query, as (distance squared, vector) pairs
+				closest first.  A beam_width of 1 follows the same path as an insert would.
+			*/
+			void search(std::vector<std::pair<float, object *>> &results, object *query, size_t k, size_t beam_width = 1) const;
+
+			/*
+				K_TREE::SEARCH_BATCH()
+				----------------------
+				Search for each of queries[0..count-1] (with a beam width of 1, the path an insert would take) putting the k vectors
+				found for queries[i] in results[i].  The queries are descended group at a time, interleaved, so that the cache misses
+				of one query are overlapped with the distance computations of the others
+			*/
+			void search_batch(std::vector<std::vector<std::pair<float, object *>>> &results, object *const *queries, size_t count, size_t k, size_t group = 8) const;
 
 			/*
 				K_TREE::GET_EXAMPLE_OBJECT
@@ -51,6 +259,21 @@ namespace k_tree
 			*/
 			object *get_example_object(void);
 
+			/*
+				K_TREE::STATS()
+				---------------
+				Return a snapshot of the instrumentation counters (the tree counters are only kept if K_TREE_STATS is defined)
+			*/
+			statistics stats(void) const;
+
+			/*
+				K_TREE::ANALYSE()
+				-----------------
+				Return the shape and quality of the tree (depth, fan-out, fill, sum of squared errors, and centroid drift).  This walks the
+				whole tree, dividing the work between the given number of threads (0 means one per CPU core)
+			*/
+			analysis analyse(size_t threads = 0) const;
+
 			/*
 				K_TREE::TEXT_RENDER()
 				---------------------
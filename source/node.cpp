@@ -4,11 +4,15 @@
 	Copyright (c) 2020 Andrew Trotman
 	Released under the 2-clause BSD license (See:https://en.wikipedia.org/wiki/BSD_licenses)
 */
+#include <math.h>
 #include <stdint.h>
 #include <malloc.h>
 
 #include <limits>
 #include <iomanip>
+#include <vector>
+#include <queue>
+#include <algorithm>
 
 #include "node.h"
 
@@ -22,8 +26,11 @@ namespace k_tree
 		max_children(0),
 		children(0),
 		child(nullptr),
+		parent(nullptr),
 		centroid(nullptr),
-		leaves_below_this_point(1)
+		leaves_below_this_point(1),
+		dead_below(0),
+		inner(nullptr)
 		{
 		/* Nothing */
 		}
@@ -32,11 +39,59 @@ namespace k_tree
 		NODE::NEW_NODE()
 		----------------
 	*/
-	node *node::new_node(allocator *memory, object *data) const
+	node *node::new_node(context *tree, allocator *memory, object *data) const
 		{
-		node *answer = new (memory->malloc(sizeof(node))) node();
+		node *answer;
+
+		if (tree->absorb_radius != 0)
+			{
+			/*
+				A micro-cluster, which owns its centroid as the vectors it absorbs move it.  The caller keeps data
+			*/
+			object *own_centroid;
+			if (tree->spare_leaves.empty())
+				{
+				answer = (node *)memory->malloc(sizeof(node));
+				own_centroid = centroid->new_object(memory);
+				}
+			else
+				{
+				answer = tree->spare_leaves.back();
+				own_centroid = answer->centroid;
+				tree->spare_leaves.pop_back();
+				}
+			answer = new (answer) node();
+			answer->max_children = max_children;
+			answer->centroid = own_centroid;
+			answer->scatter = 0;
+			*answer->centroid = *data;
+			tree->micro_clusters++;
+
+			return answer;
+			}
+
+		if (tree->spare_leaves.empty())
+			answer = new (memory->malloc(sizeof(node))) node();
+		else
+			{
+			answer = new (tree->spare_leaves.back()) node();
+			tree->spare_leaves.pop_back();
+			}
 		answer->max_children = max_children;
 		answer->centroid = data;
+		answer->scatter = 0;
+
+		if (tree->index_leaves)
+			tree->leaf_of[data] = answer;
+
+		/*
+			The newest leaf with these bits is the one duplicates go to.  The key is replaced too as it points into the old leaf
+		*/
+		if (tree->collapse_duplicates)
+			{
+			tree->leaf_with.erase(data);
+			tree->leaf_with.emplace(data, answer);
+			}
 
 		return answer;
 		}
@@ -45,18 +100,54 @@ namespace k_tree
 		NODE::NEW_NODE()
 		----------------
 	*/
-	node *node::new_node(allocator *memory, node *first_child) const
+	node *node::new_node(context *tree, allocator *memory, node *first_child) const
 		{
-		node *answer = new (memory->malloc(sizeof(node))) node();
-		answer->max_children = max_children;
-		answer->child = (new (memory->malloc(sizeof(node *) * (max_children + 1))) node *[max_children + 1]),
-		answer->centroid = centroid->new_object(memory);
+		node *answer;
+
+		if (!tree->spare_nodes.empty() && tree->spare_nodes.back()->max_children == max_children)
+			{
+			/*
+				Reuse a node taken out of the tree, keeping its arrays and vectors (they are all re-initialised before they are read)
+			*/
+			node *spare = tree->spare_nodes.back();
+			node **spare_child = spare->child;
+			object *spare_centroid = spare->centroid;
+			interior *spare_inner = spare->inner;
+			object *spare_sum = spare_inner->sum;
+			object *spare_pending = spare_inner->pending;
+			object **spare_buffer = spare_inner->buffer;
+			tree->spare_nodes.pop_back();
+
+			answer = new (spare) node();
+			answer->child = spare_child;
+			answer->centroid = spare_centroid;
+			answer->inner = new (spare_inner) interior();
+			answer->inner->sum = spare_sum;
+			answer->inner->pending = spare_pending;
+			answer->inner->buffer = spare_buffer;
+			answer->max_children = max_children;
+			answer->inner->capacity = max_children + 1 + tree->overflow_slack;
+			}
+		else
+			{
+			/*
+				The interior goes straight after the node so that the two share cache lines
+			*/
+			answer = new (memory->malloc(sizeof(node) + sizeof(interior))) node();
+			answer->inner = new (answer + 1) interior();
+			answer->max_children = max_children;
+			answer->inner->capacity = max_children + 1 + tree->overflow_slack;
+			answer->child = (new (memory->malloc(sizeof(node *) * answer->inner->capacity)) node *[answer->inner->capacity]),
+			answer->centroid = centroid->new_object(memory);
+			}
 
 		if (first_child == nullptr)
 			answer->leaves_below_this_point = answer->children = 0;
 		else
 			{
 			answer->child[0] = first_child;
+			answer->dead_below = first_child->dead_below;
+			first_child->parent = answer;
 			answer->children = 1;
 			}
 
@@ -76,41 +167,174 @@ namespace k_tree
 	/*
 		NODE::CLOSEST()
 		---------------
-		Returns the index of the child closest to the parameter what
+		Returns the index of the child closest to the parameter what, and (if distance is not nullptr) the square of the distance to it.
+		If the distances between the children are known (child_distance) then the triangle inequality is used to skip children that
+		cannot be closer than the closest so far.  The distances computed and skipped are added to counters.
 	*/
-	size_t node::closest(object *what) const
+	size_t node::closest(statistics *counters, object *what, float *distance) const
 		{
 		/*
 			Initialise to the distance to the first element in the list
 		*/
 		size_t closest_child = 0;
 		float min_distance = what->distance_squared(child[0]->centroid);
+		K_TREE_COUNT(counters->distance_computations++);
 
 		/*
 			Now check the distance to the others
 		*/
-		for (size_t which = 1; which < children; which++)
+		if (inner->child_distance == nullptr)
+			{
+			for (size_t which = 1; which < children; which++)
+				{
+				float distance = what->distance_squared(child[which]->centroid);
+				if (distance < min_distance)
+					{
+					min_distance = distance;
+					closest_child = which;
+					}
+				}
+			K_TREE_COUNT(counters->distance_computations += children - 1);
+			}
+		else
 			{
-			float distance = what->distance_squared(child[which]->centroid);
-			if (distance < min_distance)
+			/*
+				If the distance from the closest child so far (b) to child c is at least twice the distance from what to b then c cannot be
+				closer to what than b is (the triangle inequality).  The distances in child_distance were correct when computed, but the
+				children have moved since then (by at most their drift), so the distance from b to c is at least the stored distance less
+				the drift of each.  All this is done without square roots by comparing the squares.  The distances that are computed use
+				the plain kernel, an early exit saves little at these lengths and the branch costs more than it saves.
+			*/
+			const float *drift = child_drift();
+			for (size_t which = 1; which < children; which++)
 				{
-				min_distance = distance;
-				closest_child = which;
+				float lower_bound = inner->child_distance[closest_child * inner->capacity + which] - drift[closest_child] - drift[which];
+				if (lower_bound > 0 && lower_bound * lower_bound > 4 * min_distance * triangle_slack)
+					{
+					K_TREE_COUNT(counters->triangle_prunes++);
+					continue;
+					}
+
+				K_TREE_COUNT(counters->distance_computations++);
+				float distance = what->distance_squared(child[which]->centroid);
+				if (distance < min_distance)
+					{
+					min_distance = distance;
+					closest_child = which;
+					}
 				}
 			}
 
+		if (distance != nullptr)
+			*distance = min_distance;
+
 		return closest_child;
 		}
 
+	/*
+		NODE::COMPUTE_CHILD_DISTANCES()
+		-------------------------------
+		Allocate (if necessary) and fill in the matrix of distances between the children of this node
+	*/
+	void node::compute_child_distances(context *tree, allocator *memory)
+		{
+		if (inner->child_distance == nullptr)
+			{
+			if (!tree->spare_distances.empty() && tree->spare_distances.back().first == inner->capacity)
+				{
+				inner->child_distance = tree->spare_distances.back().second;
+				tree->spare_distances.pop_back();
+				}
+			else
+				inner->child_distance = (float *)memory->malloc(sizeof(*inner->child_distance) * inner->capacity * (inner->capacity + 2));
+			if (tree->lazy_batch != 0)
+				scratch_vector(tree, memory, 0);		// refresh() measures how far a lazy centroid moves in this
+			}
+
+		/*
+			The matrix is symmetric so compute each distance once
+		*/
+		float *nearest_sibling = child_nearest();
+		std::fill(nearest_sibling, nearest_sibling + inner->capacity, std::numeric_limits<float>::max());
+		K_TREE_COUNT(tree->counters.distance_computations += children * (children - 1) / 2);
+		for (size_t which = 0; which < children; which++)
+			{
+			for (size_t sibling = which + 1; sibling < children; sibling++)
+				{
+				float distance = sqrtf(child[which]->centroid->distance_squared(child[sibling]->centroid));
+				inner->child_distance[which * inner->capacity + sibling] = inner->child_distance[sibling * inner->capacity + which] = distance;
+				nearest_sibling[which] = std::min(nearest_sibling[which], distance);
+				nearest_sibling[sibling] = std::min(nearest_sibling[sibling], distance);
+				}
+			inner->child_distance[which * inner->capacity + which] = 0;
+			child_drift()[which] = 0;
+			}
+		}
+
+	/*
+		NODE::UPDATE_CHILD_DISTANCES()
+		------------------------------
+		Recompute the distances from the given child to its siblings
+	*/
+	void node::update_child_distances(context *tree, size_t which)
+		{
+		float nearest = std::numeric_limits<float>::max();
+		float *nearest_sibling = child_nearest();
+
+		K_TREE_COUNT(tree->counters.distance_computations += children - 1);
+		for (size_t sibling = 0; sibling < children; sibling++)
+			if (sibling != which)
+				{
+				float distance = sqrtf(child[which]->centroid->distance_squared(child[sibling]->centroid));
+				inner->child_distance[which * inner->capacity + sibling] = inner->child_distance[sibling * inner->capacity + which] = distance;
+				nearest = std::min(nearest, distance);
+				nearest_sibling[sibling] = std::min(nearest_sibling[sibling], distance);
+				}
+
+		inner->child_distance[which * inner->capacity + which] = 0;
+		child_drift()[which] = 0;
+		nearest_sibling[which] = nearest;
+		}
+
 	/*
 		NODE::COMPUTE_MEAN()
 		--------------------
 		Compute the centroid of the children below this node.  Note that this must be a weighted average as not all branched have the
 		same number of children and this resulting centroid should be the middle of the leaves not the middle of the children.  This also
-		recomputes that count from the children (which might have recently changed)
+		recomputes that count from the children (which might have recently changed).  With running sums it is the sum that is recomputed
+		(it is allocated on first use), then the centroid is the sum multiplied by the reciprocal of the count.  Any deferred updates
+		are discarded as the centroid is now exact (so the children must not be dirty).
 	*/
-	void node::compute_mean(void)
+	void node::compute_mean(context *tree, allocator *memory)
 		{
+		K_TREE_COUNT(tree->counters.compute_mean_calls++);
+
+		inner->pending_count = 0;
+
+		if (tree->running_sums)
+			{
+			/*
+				The sum is the sum of the sums of the children (a vector is its own sum times its weight), and the centroid is that sum
+				divided by the count
+			*/
+			if (inner->sum == nullptr)
+				inner->sum = centroid->new_object(memory);
+
+			leaves_below_this_point = 0;
+			inner->sum->zero();
+			for (size_t which = 0; which < children; which++)
+				{
+				leaves_below_this_point += child[which]->leaves_below_this_point;
+				if (child[which]->isleaf() || child[which]->inner->sum == nullptr)
+					inner->sum->fused_multiply_add(*child[which]->centroid, (float)child[which]->leaves_below_this_point);
+				else
+					*inner->sum += *child[which]->inner->sum;
+				}
+
+			centroid->scale(*inner->sum, (float)1.0 / leaves_below_this_point);
+			return;
+			}
+
 		leaves_below_this_point = 0;
 		centroid->zero();
 		for (size_t which = 0; which < children; which++)
@@ -123,64 +347,284 @@ namespace k_tree
 		}
 
 	/*
-		NODE::SPLIT()
-		-------------
-		Split this node into two new children
+		NODE::REFRESH()
+		---------------
+		If this node is dirty (see context::lazy_batch) then apply its deferred updates to its centroid.  With running sums the sum is
+		always up to date so the centroid is the sum multiplied by the reciprocal of the count.  Otherwise the node has the sum of the
+		pending_count vectors added since the centroid was computed, and the new mean is
+			centroid + (pending - pending_count * centroid) / leaves_below_this_point
+		This is the only place a lazy centroid moves, so if the node above prunes with the triangle inequality then the distance it
+		actually moved is added to its drift there (see closest())
 	*/
-	void node::split(allocator *memory, node **child_1_out, node **child_2_out) const
+	void node::refresh(context *tree)
 		{
-		size_t place_in;
-#ifdef _MSC_VER
-		size_t *assignment = (size_t *)alloca(sizeof(*assignment * (max_children + 1)));
-#else
-		size_t assignment[max_children + 1];
-#endif
-		size_t first_cluster_size;
-		size_t second_cluster_size;
-		float old_sum_distance = std::numeric_limits<float>::max();;
-		float new_sum_distance = old_sum_distance / 2;
+		if (isleaf() || inner->pending_count == 0)
+			return;
+
+		object *before = nullptr;
+		if (tree->lazy_batch != 0 && parent != nullptr && parent->inner->child_distance != nullptr)
+			{
+			before = tree->scratch[0];			// allocated by compute_child_distances()
+			*before = *centroid;
+			}
+
+		K_TREE_COUNT(tree->counters.centroid_refreshes++);
+		if (tree->running_sums)
+			centroid->scale(*inner->sum, (float)1.0 / leaves_below_this_point);
+		else
+			centroid->absorb(*inner->pending, (float)inner->pending_count, (float)1.0 / leaves_below_this_point);
+
+		inner->pending_count = 0;
+
+		if (before != nullptr)
+			for (size_t which = 0; which < parent->children; which++)
+				if (parent->child[which] == this)
+					{
+					parent->child_drift()[which] += sqrtf(centroid->distance_squared(before));
+					break;
+					}
+		}
+
+	/*
+		NODE::REFRESH_SUBTREE()
+		-----------------------
+		Refresh every dirty node at or below this point
+	*/
+	void node::refresh_subtree(context *tree)
+		{
+		if (isleaf())
+			return;
+
+		refresh(tree);
+		for (size_t which = 0; which < children; which++)
+			child[which]->refresh_subtree(tree);
+		}
+
+	/*
+		NODE::SCRATCH_VECTOR()
+		----------------------
+		Return one of the tree's scratch vectors (used as workspace by split()), allocating it if this is its first use
+	*/
+	object *node::scratch_vector(context *tree, allocator *memory, size_t which) const
+		{
+		while (tree->scratch.size() <= which)
+			tree->scratch.push_back(centroid->new_object(memory));
+
+		return tree->scratch[which];
+		}
+
+	/*
+		NODE::SEED()
+		------------
+		Choose the two initial centroids for two_means() from members[0..count-1] using context::split_method
+	*/
+	void node::seed(context *tree, node *const *members, size_t count, object *centroid_1, object *centroid_2) const
+		{
+		size_t first_choice = 0;
+		size_t best_choice = 1;
+
+		if (tree->split_method == context::CLOSEST_SEEDS)
+			{
+			/*
+				The first member and the member closest to it
+			*/
+			float smallest_distance = members[0]->centroid->distance_squared(members[1]->centroid);
+			for (size_t which = 2; which < count; which++)
+				{
+				float distance = members[0]->centroid->distance_squared(members[which]->centroid);
+				if (distance < smallest_distance)
+					{
+					best_choice = which;
+					smallest_distance = distance;
+					}
+				}
+			K_TREE_COUNT(tree->counters.distance_computations += count - 1);
+			}
+		else if (tree->split_method == context::FARTHEST_SEEDS)
+			{
+			/*
+				The member farthest from the first member, and then the member farthest from that
+			*/
+			for (size_t pass = 0; pass < 2; pass++)
+				{
+				const object *from = members[pass == 0 ? 0 : best_choice]->centroid;
+				size_t farthest = 0;
+				float largest_distance = -1;
+				for (size_t which = 0; which < count; which++)
+					{
+					float distance = members[which]->centroid->distance_squared(from);
+					if (distance > largest_distance)
+						{
+						farthest = which;
+						largest_distance = distance;
+						}
+					}
+				first_choice = best_choice;
+				best_choice = farthest;
+				}
+			K_TREE_COUNT(tree->counters.distance_computations += 2 * count);
+			}
+		else
+			{
+			/*
+				k-means++: a random member, then a member chosen with probability proportional to its squared distance from the first
+			*/
+			std::vector<float> cumulative(count);
+			float total = 0;
+
+			first_choice = tree->random() % count;
+			for (size_t which = 0; which < count; which++)
+				{
+				total += members[which]->centroid->distance_squared(members[first_choice]->centroid);
+				cumulative[which] = total;
+				}
+			K_TREE_COUNT(tree->counters.distance_computations += count);
+
+			if (total == 0)
+				best_choice = (first_choice + 1) % count;
+			else
+				{
+				float target = std::uniform_real_distribution<float>(0, total)(tree->random);
+				best_choice = std::upper_bound(cumulative.begin(), cumulative.end(), target) - cumulative.begin();
+				if (best_choice >= count)
+					best_choice = count - 1;
+				}
+			}
+
+		*centroid_1 = *members[first_choice]->centroid;
+		*centroid_2 = *members[best_choice]->centroid;
+		}
+
+	/*
+		NODE::PDDP()
+		------------
+		Principal Direction Divisive Partitioning: split members[0..count-1] by which side of their mean they fall along their
+		principal direction.  The principal direction is found by power iteration on the covariance matrix, without forming the
+		matrix, as Cv = sum((x - mean)((x - mean).v)).  centroid_1 and centroid_2 are set to the means of the two halves.  Returns
+		the number of power iterations.
+		See: D. Boley (1998) Principal Direction Divisive Partitioning, Data Mining and Knowledge Discovery 2(4):325-344.
+	*/
+	size_t node::pddp(context *tree, allocator *memory, node *const *members, size_t count, object *centroid_1, object *centroid_2, size_t *assignment) const
+		{
+		object *mean = scratch_vector(tree, memory, 2);
+		object *direction = scratch_vector(tree, memory, 3);
+		object *next_direction = scratch_vector(tree, memory, 4);
+		std::vector<float> projection(count);
+		size_t iterations = 0;
+
+		mean->zero();
+		for (size_t which = 0; which < count; which++)
+			*mean += *members[which]->centroid;
+		*mean /= (float)count;
 
 		/*
-			allocate space
+			Start from the direction of the member farthest from the mean
 		*/
-		object *centroid_1 = centroid->new_object(memory);
-		object *centroid_2 = centroid->new_object(memory);
-		node *child_1 = *child_1_out = new_node(memory, (node *)nullptr);
-		node *child_2 = *child_2_out = new_node(memory, (node *)nullptr);
+		size_t farthest = 0;
+		float largest_distance = -1;
+		for (size_t which = 0; which < count; which++)
+			{
+			float distance = members[which]->centroid->distance_squared(mean);
+			if (distance > largest_distance)
+				{
+				farthest = which;
+				largest_distance = distance;
+				}
+			}
+		K_TREE_COUNT(tree->counters.distance_computations += count);
+		*direction = *members[farthest]->centroid;
+		direction->fused_multiply_add(*mean, -1.0);
+		float length = sqrtf(direction->dot_product(direction));
 
 		/*
-			Start with the first member, then find the furthest away member and use that as the second point
+			Power iteration
 		*/
-		*centroid_1 = *child[0]->centroid;
-
-		size_t best_choice = 1;
-		double smallest_distance = centroid_1->distance_squared(child[1]->centroid);
-		for (size_t which = 2; which <= max_children; which++)
+		while (length > 0)
 			{
-			float distance = centroid_1->distance_squared(child[which]->centroid);
-			if (distance < smallest_distance)
+			*direction /= length;
+			iterations++;
+
+			float mean_projection = mean->dot_product(direction);
+			float total_projection = 0;
+			next_direction->zero();
+			for (size_t which = 0; which < count; which++)
+				{
+				projection[which] = members[which]->centroid->dot_product(direction) - mean_projection;
+				total_projection += projection[which];
+				next_direction->fused_multiply_add(*members[which]->centroid, projection[which]);
+				}
+			next_direction->fused_multiply_add(*mean, -total_projection);
+
+			length = sqrtf(next_direction->dot_product(next_direction));
+			if (length == 0)
+				break;
+			float agreement = next_direction->dot_product(direction) / length;
+			std::swap(direction, next_direction);
+			if (agreement > 1.0 - pddp_tolerance || iterations >= pddp_max_iterations || (tree->split_max_iterations != 0 && iterations >= tree->split_max_iterations))
 				{
-				best_choice = which;
-				smallest_distance = distance;
+				*direction /= length;
+				break;
 				}
 			}
-		*centroid_2 = *child[best_choice]->centroid;
+
+		/*
+			Split on the sign of the projection onto the principal direction (ties go to the smaller side), and compute the two means
+		*/
+		float mean_projection = mean->dot_product(direction);
+		size_t cluster_size[2] = {0, 0};
+		centroid_1->zero();
+		centroid_2->zero();
+		for (size_t which = 0; which < count; which++)
+			{
+			float side = members[which]->centroid->dot_product(direction) - mean_projection;
+			size_t place_in = side == 0 ? (cluster_size[0] < cluster_size[1] ? 0 : 1) : (side < 0 ? 0 : 1);
+			assignment[which] = place_in;
+			cluster_size[place_in]++;
+			*(place_in == 0 ? centroid_1 : centroid_2) += *members[which]->centroid;
+			}
+		*centroid_1 /= (float)std::max(cluster_size[0], (size_t)1);
+		*centroid_2 /= (float)std::max(cluster_size[1], (size_t)1);
+
+		return iterations;
+		}
+
+	/*
+		NODE::TWO_MEANS()
+		-----------------
+		Lloyd's algorithm over members[0..count-1]: assign each member to its closest centroid then move the centroids to the mean of their members, repeating
+		until the sum of squared distances stops falling.  Returns the number of iterations
+	*/
+	size_t node::two_means(context *tree, node *const *members, size_t count, object *centroid_1, object *centroid_2, size_t *assignment) const
+		{
+		size_t place_in;
+		size_t first_cluster_size;
+		size_t second_cluster_size;
+		size_t iterations = 0;
+		float old_sum_distance = std::numeric_limits<float>::max();;
+		float new_sum_distance = old_sum_distance / 2;
 
 		/*
 			The stopping condition is that the sum squared distance from the cluster centres has become constant (so no more shuffling can happen)
 		*/
 		while (old_sum_distance > (1.0 + float_resolution) * new_sum_distance)
 			{
+			if (tree->split_max_iterations != 0 && iterations >= tree->split_max_iterations)
+				{
+				K_TREE_COUNT(tree->counters.splits_capped++);
+				break;
+				}
+			iterations++;
+			K_TREE_COUNT(tree->counters.distance_computations += 2 * count);
 			old_sum_distance = new_sum_distance;
 			new_sum_distance = 0;
 			first_cluster_size = second_cluster_size = 0;
-			for (size_t which = 0; which < children; which++)
+			for (size_t which = 0; which < count; which++)
 				{
 				/*
 					Compute the distance (squared) to each of the two new cluster centroids
 				*/
-				float distance_to_first = centroid_1->distance_squared(child[which]->centroid);
-				float distance_to_second = centroid_2->distance_squared(child[which]->centroid);
+				float distance_to_first = centroid_1->distance_squared(members[which]->centroid);
+				float distance_to_second = centroid_2->distance_squared(members[which]->centroid);
 
 				/*
 					Choose a cluster, tie_break on the size of the cluster (put in the smallest to avoid empty clusters)
@@ -214,12 +658,12 @@ namespace k_tree
 			*/
 			centroid_1->zero();
 			centroid_2->zero();
-			for (size_t which = 0; which < children; which++)
+			for (size_t which = 0; which < count; which++)
 				{
 				if (assignment[which] == 0)
-					*centroid_1 += *child[which]->centroid;
+					*centroid_1 += *members[which]->centroid;
 				else
-					*centroid_2 += *child[which]->centroid;
+					*centroid_2 += *members[which]->centroid;
 				}
 
 			/*
@@ -229,75 +673,600 @@ namespace k_tree
 			*centroid_2 /= (float)second_cluster_size;
 			}
 
+		return iterations;
+		}
+
+	/*
+		NODE::TWO_MEANS_BOUNDED()
+		-------------------------
+		Hamerly's accelerated k-means (for k=2) over members[0..count-1].  Each child keeps an upper bound on its distance to its own centroid and a lower bound
+		on its distance to the other.  When the centroids move the bounds are loosened by the distance moved, and a child is only
+		re-examined if its upper bound exceeds its lower bound.  The centroid sums are updated as children change cluster rather
+		than being recomputed.  Stops when no child changes cluster.  Returns the number of iterations
+		See: G. Hamerly (2010) Making k-means even faster, Proceedings of the 2010 SIAM International Conference on Data Mining, pp. 130-140.
+	*/
+	size_t node::two_means_bounded(context *tree, allocator *memory, node *const *members, size_t count, object *centroid_1, object *centroid_2, size_t *assignment) const
+		{
+		object *centroid[2] = {centroid_1, centroid_2};
+		object *sum[2] = {scratch_vector(tree, memory, 2), scratch_vector(tree, memory, 3)};
+		object *moved_to = scratch_vector(tree, memory, 4);
+		std::vector<float> upper(count);
+		std::vector<float> lower(count);
+		size_t cluster_size[2] = {0, 0};
+		float movement[2];
+		size_t iterations = 1;
+
 		/*
-			At this point we have the new centroids and we have which node goes where in assignment[] so we populate the two new nodes
+			The first iteration computes both distances for every child, exactly as two_means() would
 		*/
-		for (size_t which = 0; which < children; which++)
-			if (assignment[which] == 0)
+		K_TREE_COUNT(tree->counters.distance_computations += 2 * count);
+		sum[0]->zero();
+		sum[1]->zero();
+		for (size_t which = 0; which < count; which++)
+			{
+			float distance_to_first = sqrtf(centroid_1->distance_squared(members[which]->centroid));
+			float distance_to_second = sqrtf(centroid_2->distance_squared(members[which]->centroid));
+			size_t place_in;
+
+			if (distance_to_first == distance_to_second)
+				place_in = cluster_size[0] < cluster_size[1] ? 0 : 1;
+			else
+				place_in = distance_to_first < distance_to_second ? 0 : 1;
+
+			assignment[which] = place_in;
+			upper[which] = place_in == 0 ? distance_to_first : distance_to_second;
+			lower[which] = place_in == 0 ? distance_to_second : distance_to_first;
+			cluster_size[place_in]++;
+			*sum[place_in] += *members[which]->centroid;
+			}
+
+		bool changed = true;
+		while (changed)
+			{
+			/*
+				Move the centroids to the mean of their children and note how far they moved.  The seeds are children so neither
+				cluster should be empty, but if one is then it keeps its centroid rather than dividing by zero
+			*/
+			for (size_t cluster = 0; cluster < 2; cluster++)
 				{
-				child_1->child[child_1->children] = child[which];
-				child_1->children++;
+				movement[cluster] = 0;
+				if (cluster_size[cluster] == 0)
+					continue;
+				*moved_to = *sum[cluster];
+				*moved_to /= (float)cluster_size[cluster];
+				movement[cluster] = sqrtf(moved_to->distance_squared(centroid[cluster]));
+				*centroid[cluster] = *moved_to;
 				}
-			else
+
+			if (tree->split_max_iterations != 0 && iterations >= tree->split_max_iterations)
 				{
-				child_2->child[child_2->children] = child[which];
-				child_2->children++;
+				K_TREE_COUNT(tree->counters.splits_capped++);
+				break;
 				}
-		}
+			iterations++;
 
-	/*
-		NODE::ADD_TO_LEAF()
-		-------------------
-		Add the given data to the current leaf node.
-		Returns whether or not there was a split (and so the node above must do a replacement and an add)
-	*/
-	bool node::add_to_leaf(allocator *memory, object *data, node **child_1, node **child_2)
-		{
-		node *another = node::new_node(memory, data);
-		child[children] = another;
-		children++;
-		if (children > max_children)
-			{
-			split(memory, child_1, child_2);
-			(*child_1)->compute_mean();
-			(*child_2)->compute_mean();
-			return true;
+			/*
+				Reassign the children whose bounds no longer guarantee that they are in the right cluster
+			*/
+			changed = false;
+			for (size_t which = 0; which < count; which++)
+				{
+				size_t mine = assignment[which];
+				size_t other = 1 - mine;
+
+				upper[which] += movement[mine];
+				lower[which] -= movement[other];
+				if (upper[which] <= lower[which])
+					{
+					K_TREE_COUNT(tree->counters.split_iterations_saved++);
+					K_TREE_COUNT(tree->counters.split_distances_saved += 2);
+					continue;
+					}
+
+				/*
+					Tighten the upper bound and try again
+				*/
+				K_TREE_COUNT(tree->counters.distance_computations++);
+				upper[which] = sqrtf(centroid[mine]->distance_squared(members[which]->centroid));
+				if (upper[which] <= lower[which])
+					{
+					K_TREE_COUNT(tree->counters.split_distances_saved++);
+					continue;
+					}
+
+				K_TREE_COUNT(tree->counters.distance_computations++);
+				lower[which] = sqrtf(centroid[other]->distance_squared(members[which]->centroid));
+				if (lower[which] < upper[which] && cluster_size[mine] > 1)
+					{
+					/*
+						Move the child to the other cluster
+					*/
+					std::swap(upper[which], lower[which]);
+					assignment[which] = other;
+					cluster_size[mine]--;
+					cluster_size[other]++;
+					sum[mine]->fused_multiply_add(*members[which]->centroid, -1.0);
+					*sum[other] += *members[which]->centroid;
+					changed = true;
+					}
+				}
 			}
-		return false;
+
+		return iterations;
 		}
 
 	/*
-		NODE::ADD_TO_NODE()
-		-------------------
-		Add the given data to the current tree at or below this point.
-		Returns whether or not there was a split (and so the node above must do a replacement and an add)
+		NODE::K_MEANS()
+		---------------
+		Lloyd's algorithm with ways centroids over members[0..count-1], used for multi-way splits.  The seeds are chosen by farthest
+		first traversal if context::split_method is FARTHEST_SEEDS, otherwise by k-means++.  The centroids are left in the scratch
+		vectors from first_centroid onwards.  Stops when no member changes cluster.  Returns the number of iterations
 	*/
-	bool node::add_to_node(allocator *memory, object *data, node **child_1, node **child_2)
+	size_t node::k_means(context *tree, allocator *memory, node *const *members, size_t count, size_t ways, size_t first_centroid, size_t *assignment) const
 		{
-		bool did_split = false;
-		if (child[0]->isleaf())
-			did_split = add_to_leaf(memory, data, child_1, child_2);
-		else
+		std::vector<object *> centroid(ways);
+		std::vector<size_t> cluster_size(ways);
+		std::vector<float> nearest(count, std::numeric_limits<float>::max());
+		size_t iterations = 0;
+
+		for (size_t cluster = 0; cluster < ways; cluster++)
+			centroid[cluster] = scratch_vector(tree, memory, first_centroid + cluster);
+
+		/*
+			Seed: each new seed is the member farthest from (or chosen with probability proportional to the squared distance to) the
+			closest seed so far
+		*/
+		size_t chosen = tree->split_method == context::FARTHEST_SEEDS ? 0 : tree->random() % count;
+		for (size_t cluster = 0; cluster < ways; cluster++)
 			{
-			size_t best_child = closest(data);
-			did_split = child[best_child]->add_to_node(memory, data, child_1, child_2);
-			if (did_split)
-				{
-				did_split = false;
-				child[best_child] = *child_1;
-				child[children] = *child_2;
-				children++;
+			*centroid[cluster] = *members[chosen]->centroid;
+			if (cluster == ways - 1)
+				break;
 
-				if (children > max_children)
+			float total = 0;
+			float largest_distance = -1;
+			K_TREE_COUNT(tree->counters.distance_computations += count);
+			for (size_t which = 0; which < count; which++)
+				{
+				nearest[which] = std::min(nearest[which], centroid[cluster]->distance_squared(members[which]->centroid));
+				total += nearest[which];
+				if (nearest[which] > largest_distance)
 					{
-					split(memory, child_1, child_2);
-					(*child_1)->compute_mean();
-					(*child_2)->compute_mean();
-					did_split = true;
+					largest_distance = nearest[which];
+					chosen = which;
 					}
 				}
-			}
-		/*
+
+			if (tree->split_method != context::FARTHEST_SEEDS && total > 0)
+				{
+				float target = std::uniform_real_distribution<float>(0, total)(tree->random);
+				for (chosen = 0; chosen < count - 1 && target >= nearest[chosen]; chosen++)
+					target -= nearest[chosen];
+				}
+			}
+
+		/*
+			Lloyd's algorithm
+		*/
+		bool changed = true;
+		while (changed)
+			{
+			if (tree->split_max_iterations != 0 && iterations >= tree->split_max_iterations)
+				{
+				K_TREE_COUNT(tree->counters.splits_capped++);
+				break;
+				}
+			iterations++;
+
+			/*
+				A member stays in its cluster unless another is strictly closer.  Otherwise identical members (whose cluster means are
+				not exactly the member after rounding) can swap between tied clusters forever
+			*/
+			changed = false;
+			K_TREE_COUNT(tree->counters.distance_computations += ways * count);
+			for (size_t which = 0; which < count; which++)
+				{
+				size_t best_cluster = iterations == 1 ? 0 : assignment[which];
+				float best_distance = centroid[best_cluster]->distance_squared(members[which]->centroid);
+				for (size_t cluster = 0; cluster < ways; cluster++)
+					{
+					if (cluster == best_cluster)
+						continue;
+					float distance = centroid[cluster]->distance_squared(members[which]->centroid, best_distance);
+					if (distance < best_distance)
+						{
+						best_cluster = cluster;
+						best_distance = distance;
+						}
+					}
+				if (iterations == 1 || assignment[which] != best_cluster)
+					{
+					assignment[which] = best_cluster;
+					changed = true;
+					}
+				}
+
+			/*
+				Move the centroids to the mean of their members (an empty cluster keeps its centroid)
+			*/
+			std::fill(cluster_size.begin(), cluster_size.end(), 0);
+			for (size_t which = 0; which < count; which++)
+				cluster_size[assignment[which]]++;
+			for (size_t cluster = 0; cluster < ways; cluster++)
+				if (cluster_size[cluster] != 0)
+					centroid[cluster]->zero();
+			for (size_t which = 0; which < count; which++)
+				*centroid[assignment[which]] += *members[which]->centroid;
+			for (size_t cluster = 0; cluster < ways; cluster++)
+				if (cluster_size[cluster] != 0)
+					*centroid[cluster] /= (float)cluster_size[cluster];
+			}
+
+		return iterations;
+		}
+
+	/*
+		NODE::SPLIT()
+		-------------
+		Split the nodes in from[0..count-1] (usually this node's children) into context::split_ways new nodes, which are returned
+		in into.  If context::split_sample is set and there are more than that many nodes then the centroids are found from a random
+		sample, and every node is then assigned to the closest centroid.  Every new node gets at least one of the nodes, so none
+		has more than count - (ways - 1).
+	*/
+	void node::split(context *tree, allocator *memory, node *const *from, size_t count, std::vector<node *> &into) const
+		{
+		size_t ways = std::min(std::max(tree->split_ways, (size_t)2), std::min(std::min(tree->max_split_ways, max_children), count));
+		std::vector<size_t> assignment(count);
+
+		/*
+			Use up one of the splits the insert is allowed (see context::split_budget)
+		*/
+		if (tree->splits_left > 0)
+			tree->splits_left--;
+		else
+			K_TREE_COUNT(tree->counters.forced_splits++);
+
+		/*
+			The clustering (and compute_mean()) needs the exact centroids of the nodes
+		*/
+		for (size_t which = 0; which < count; which++)
+			from[which]->refresh(tree);
+
+		/*
+			Choose the nodes to cluster, either all of them or a random sample (a partial Fisher-Yates shuffle)
+		*/
+		node *const *members = from;
+		size_t member_count = count;
+		std::vector<node *> sample;
+		if (tree->split_sample >= ways && tree->split_sample < count)
+			{
+			sample.assign(from, from + count);
+			for (size_t which = 0; which < tree->split_sample; which++)
+				std::swap(sample[which], sample[which + tree->random() % (count - which)]);
+			sample.resize(tree->split_sample);
+			members = &sample[0];
+			member_count = sample.size();
+			K_TREE_COUNT(tree->counters.sampled_splits++);
+			}
+
+		/*
+			Cluster the members
+		*/
+		size_t iterations;
+		size_t first_centroid;
+		if (ways > 2)
+			{
+			first_centroid = 5;
+			iterations = k_means(tree, memory, members, member_count, ways, first_centroid, &assignment[0]);
+			}
+		else
+			{
+			object *centroid_1 = scratch_vector(tree, memory, 0);
+			object *centroid_2 = scratch_vector(tree, memory, 1);
+
+			first_centroid = 0;
+			if (tree->split_method == context::PDDP)
+				iterations = pddp(tree, memory, members, member_count, centroid_1, centroid_2, &assignment[0]);
+			else
+				{
+				seed(tree, members, member_count, centroid_1, centroid_2);
+				if (tree->split_bounds)
+					iterations = two_means_bounded(tree, memory, members, member_count, centroid_1, centroid_2, &assignment[0]);
+				else
+					iterations = two_means(tree, members, member_count, centroid_1, centroid_2, &assignment[0]);
+				}
+			}
+
+		/*
+			If we clustered a sample then put each node into the cluster with the closest centroid (ties go to the smaller cluster)
+		*/
+		std::vector<size_t> cluster_size(ways);
+		if (members != from)
+			{
+			K_TREE_COUNT(tree->counters.distance_computations += ways * count);
+			for (size_t which = 0; which < count; which++)
+				{
+				size_t best_cluster = 0;
+				float best_distance = scratch_vector(tree, memory, first_centroid)->distance_squared(from[which]->centroid);
+				for (size_t cluster = 1; cluster < ways; cluster++)
+					{
+					float distance = scratch_vector(tree, memory, first_centroid + cluster)->distance_squared(from[which]->centroid);
+					if (distance < best_distance || (distance == best_distance && cluster_size[cluster] < cluster_size[best_cluster]))
+						{
+						best_cluster = cluster;
+						best_distance = distance;
+						}
+					}
+				assignment[which] = best_cluster;
+				cluster_size[best_cluster]++;
+				}
+			}
+		else
+			for (size_t which = 0; which < count; which++)
+				cluster_size[assignment[which]]++;
+
+		/*
+			Make sure no cluster is empty (which can happen if the clustering was stopped early, or with duplicates), by moving a node
+			from the largest cluster
+		*/
+		for (size_t cluster = 0; cluster < ways; cluster++)
+			if (cluster_size[cluster] == 0)
+				{
+				size_t largest = std::max_element(cluster_size.begin(), cluster_size.end()) - cluster_size.begin();
+				size_t which = count;
+				while (assignment[--which] != largest)
+					{ /* Nothing */ }
+				assignment[which] = cluster;
+				cluster_size[largest]--;
+				cluster_size[cluster]++;
+				}
+
+#ifdef K_TREE_STATS
+		/*
+			Account for the split, the level is the distance from here down to the vectors
+		*/
+		size_t level = 0;
+		for (const node *current = from[0]; !current->isleaf(); current = current->child[0])
+			level++;
+
+		tree->counters.splits++;
+		if (level < statistics::max_levels)
+			tree->counters.splits_per_level[level]++;
+		tree->counters.split_iterations += iterations;
+		if (iterations > tree->counters.max_split_iterations)
+			tree->counters.max_split_iterations = iterations;
+#else
+		(void)iterations;
+#endif
+
+		/*
+			At this point we have which node goes where in assignment[] so we populate the new nodes
+		*/
+		into.clear();
+		for (size_t cluster = 0; cluster < ways; cluster++)
+			into.push_back(new_node(tree, memory, (node *)nullptr));
+
+		for (size_t which = 0; which < count; which++)
+			{
+			node *destination = into[assignment[which]];
+			destination->child[destination->children] = from[which];
+			destination->dead_below += from[which]->dead_below;
+			from[which]->parent = destination;
+			destination->children++;
+			}
+
+		/*
+			Compute the centroids of the new nodes.  With running sums the largest new node is whatever is left when the others are
+			taken from this node, which has already been updated with the vector that caused the split
+		*/
+		if (!tree->running_sums)
+			for (auto created : into)
+				created->compute_mean(tree, memory);
+		else
+			{
+			size_t largest = std::max_element(cluster_size.begin(), cluster_size.end()) - cluster_size.begin();
+			node *remainder = into[largest];
+			if (remainder->inner->sum == nullptr)
+				remainder->inner->sum = centroid->new_object(memory);
+			*remainder->inner->sum = *inner->sum;
+			remainder->leaves_below_this_point = leaves_below_this_point;
+			for (size_t cluster = 0; cluster < ways; cluster++)
+				if (cluster != largest)
+					{
+					into[cluster]->compute_mean(tree, memory);
+					remainder->inner->sum->fused_multiply_add(*into[cluster]->inner->sum, -1.0);
+					remainder->leaves_below_this_point -= into[cluster]->leaves_below_this_point;
+					}
+			remainder->centroid->scale(*remainder->inner->sum, (float)1.0 / remainder->leaves_below_this_point);
+			}
+		}
+
+	/*
+		NODE::MUST_SPLIT()
+		------------------
+		Returns whether or not this node must be split if it has extra more children than it does now.  A node with more than
+		max_children children is split while the insert has splits left (see context::split_budget).  Otherwise it waits, over-full,
+		for a later insert, unless its child array is full.
+	*/
+	bool node::must_split(context *tree, size_t extra) const
+		{
+		size_t count = children + extra;
+
+		return count > max_children && (tree->splits_left > 0 || count >= inner->capacity);
+		}
+
+	/*
+		NODE::REPLACE_CHILD()
+		---------------------
+		Replace child[which] with the nodes it was split into (in replacement).  Returns whether or not that overflowed this node,
+		in which case this node has been split and replacement holds the nodes that replace it
+	*/
+	bool node::replace_child(context *tree, allocator *memory, size_t which_child, std::vector<node *> &replacement)
+		{
+		if (children - 1 + replacement.size() <= inner->capacity)
+			{
+			/*
+				The replacements fit (perhaps with too many children) so put them in place
+			*/
+			child[which_child]->recycle(tree);
+			child[which_child] = replacement[0];
+			for (size_t which = 1; which < replacement.size(); which++)
+				child[children++] = replacement[which];
+			for (auto created : replacement)
+				created->parent = this;
+
+			if (must_split(tree))
+				{
+				split(tree, memory, child, children, replacement);
+				return true;
+				}
+			else if (inner->child_distance != nullptr)
+				{
+				update_child_distances(tree, which_child);
+				for (size_t which = children - replacement.size() + 1; which < children; which++)
+					update_child_distances(tree, which);
+				}
+			return false;
+			}
+
+		/*
+			A multi-way split gave us more children than we have room for, so split the lot
+		*/
+		std::vector<node *> members(child, child + children);
+		child[which_child]->recycle(tree);
+		members[which_child] = replacement[0];
+		members.insert(members.end(), replacement.begin() + 1, replacement.end());
+		split(tree, memory, &members[0], members.size(), replacement);
+		return true;
+		}
+
+	/*
+		NODE::ADD_TO_LEAF()
+		-------------------
+		Add the given data to the current leaf node.
+		Returns whether or not there was a split (and so the node above must replace this node with the nodes in replacement)
+	*/
+	bool node::add_to_leaf(context *tree, allocator *memory, object *data, size_t weight, std::vector<node *> &replacement)
+		{
+		if (tree->absorb_radius != 0 && absorb(tree, memory, data, weight))
+			return false;
+
+		node *another = node::new_node(tree, memory, data);
+		another->leaves_below_this_point = weight;
+		another->parent = this;
+		child[children] = another;
+		children++;
+		if (must_split(tree))
+			{
+			split(tree, memory, child, children, replacement);
+			return true;
+			}
+		return false;
+		}
+
+	/*
+		NODE::ABSORB()
+		--------------
+		A micro-cluster is a clustering feature: the number of vectors (leaves_below_this_point), their mean (centroid), and their
+		scatter (the sum of the squared distances to the mean).  Adding w copies of a vector X to a micro-cluster of n vectors with
+		mean M moves the mean as an insert does (see leave()) and, without needing the vectors themselves,
+			scatter += n * w / (n + w) * |X - M|^2
+		X is absorbed if the radius of the result (the root mean squared distance to its mean) is within context::absorb_radius.
+		Once the tree holds context::absorb_budget micro-clusters the radius is doubled until X fits.  The nodes above have already
+		counted X (see enter() and leave()) so they are right either way.
+	*/
+	bool node::absorb(context *tree, allocator *memory, object *data, size_t weight)
+		{
+		float distance;
+		size_t which = closest(&tree->counters, data, &distance);
+		node *nearest = child[which];
+		float count = (float)nearest->leaves_below_this_point;
+		float added = (float)weight;
+		float scatter = nearest->scatter + distance * count * added / (count + added);
+		float limit = tree->absorb_radius * tree->absorb_radius * (count + added);
+
+		while (scatter > limit)
+			{
+			if (tree->absorb_budget == 0 || tree->micro_clusters < tree->absorb_budget)
+				return false;
+			tree->absorb_radius *= 2;
+			limit *= 4;
+			}
+
+		K_TREE_COUNT(tree->counters.absorbs++);
+		nearest->centroid->fused_subtract_divide(*data, (count + added) / added);
+		nearest->leaves_below_this_point += weight;
+		nearest->scatter = scatter;
+
+		if (inner->child_distance != nullptr)
+			{
+			float *drift = child_drift();
+			drift[which] += sqrtf(distance) * added / (count + added);
+			if (drift[which] > tree->triangle_refresh * child_nearest()[which])
+				update_child_distances(tree, which);
+			}
+
+		return true;
+		}
+
+	/*
+		NODE::PREFETCH_CHILDREN()
+		-------------------------
+		Start loading the children and their centroids into the cache so that closest() does not stall on each in turn.  Each pass
+		issues all its loads before the next pass needs them, so the misses overlap rather than following each other.
+	*/
+	void node::prefetch_children(void) const
+		{
+		for (size_t which = 0; which < children; which++)
+			_mm_prefetch((const char *)child[which], _MM_HINT_T0);
+		for (size_t which = 0; which < children; which++)
+			_mm_prefetch((const char *)child[which]->centroid, _MM_HINT_T0);
+		for (size_t which = 0; which < children; which++)
+			child[which]->centroid->prefetch();
+		}
+
+	/*
+		NODE::ENTER()
+		-------------
+		Account for data passing through this node on its way down (see add_to_node())
+	*/
+	void node::enter(context *tree, object *data, size_t weight)
+		{
+		K_TREE_COUNT(tree->counters.nodes_visited++);
+
+		/*
+			With running sums this node is updated first as a split below here needs to know the new sum (see split()).  The sum
+			takes a vector add, and the centroid a multiply by the reciprocal of the count (both in one pass).  With lazy centroids only
+			the sum is updated, and the centroid is recomputed once every context::lazy_batch vectors.
+		*/
+		if (tree->running_sums)
+			{
+			leaves_below_this_point += weight;
+			if (tree->lazy_batch == 0 && weight == 1)
+				centroid->accumulate_and_scale(*inner->sum, *data, (float)1.0 / leaves_below_this_point);
+			else if (tree->lazy_batch == 0)
+				{
+				inner->sum->fused_multiply_add(*data, (float)weight);
+				centroid->scale(*inner->sum, (float)1.0 / leaves_below_this_point);
+				}
+			else
+				{
+				inner->sum->fused_multiply_add(*data, (float)weight);
+				inner->pending_count += weight;
+				if (inner->pending_count >= tree->lazy_batch)
+					refresh(tree);
+				}
+			}
+		}
+
+	/*
+		NODE::INCLUDE()
+		---------------
+		Move the centroid to account for data (weight vectors) having been added below this node (see leave())
+	*/
+	void node::include(context *tree, allocator *memory, object *data, size_t weight)
+		{
+		/*
 			Update the mean for the cuttent node as data has been added somewher below here.
 		*/
 		/*
@@ -310,11 +1279,134 @@ namespace k_tree
 			in the context of this method:
 				centroid += (data - centroid) / (leaves_below_this_point + 1)
 				leaves_below_this_point++;
+			A vector of weight w counts as w copies of it, so the centroid moves by w * (X - M) / (n + w).
 			Note that there is an accumulation of rounding errors.  If you want to compute the mean at each node each time then use this line instead:
-				compute_mean();
+				compute_mean(tree, memory);
+			or turn on context::running_sums.
+			With lazy centroids the new vector is added to the sum of pending vectors instead (no division), and the centroid is moved
+			once every context::lazy_batch vectors (see refresh()).  Until then it lags behind, so the parent routes on a slightly
+			stale centroid.
+		*/
+		if (!tree->running_sums)
+			{
+			if (tree->lazy_batch == 0)
+				{
+				centroid->fused_subtract_divide(*data, (float)(leaves_below_this_point + weight) / weight);
+				leaves_below_this_point += weight;
+				}
+			else
+				{
+				if (inner->pending == nullptr)
+					inner->pending = centroid->new_object(memory);
+				if (inner->pending_count == 0)
+					inner->pending->scale(*data, (float)weight);
+				else
+					inner->pending->fused_multiply_add(*data, (float)weight);
+				inner->pending_count += weight;
+				leaves_below_this_point += weight;
+				if (inner->pending_count >= tree->lazy_batch)
+					refresh(tree);
+				}
+			}
+		}
+
+	/*
+		NODE::COUNT_IN()
+		----------------
+		Account for weight more copies of data, which is already below this node, making the same updates as an insert passing
+		through (see enter() and include())
+	*/
+	void node::count_in(context *tree, allocator *memory, object *data, size_t weight)
+		{
+		enter(tree, data, weight);
+		include(tree, memory, data, weight);
+		}
+
+	/*
+		NODE::LEAVE()
+		-------------
+		Finish adding data below this node on the way back up (see add_to_node()), did_split says whether or not the level below split
+		this node.  Returns whether or not this node split (and so the node above must replace it with the nodes in replacement)
+	*/
+	bool node::leave(context *tree, allocator *memory, object *data, size_t weight, bool did_split, std::vector<node *> &replacement)
+		{
+		/*
+			If this node is over-full from an earlier insert and we can now split it, then do so
+		*/
+		if (!did_split && must_split(tree))
+			{
+			split(tree, memory, child, children, replacement);
+			did_split = true;
+			}
+
+		include(tree, memory, data, weight);
+
+		return did_split;
+		}
+
+	/*
+		NODE::ADD_TO_NODE()
+		-------------------
+		Add the given data to the current tree at or below this point.
+		Returns whether or not there was a split (and so the node above must replace this node with the nodes in replacement)
+	*/
+	bool node::add_to_node(context *tree, allocator *memory, object *data, size_t weight, std::vector<node *> &replacement)
+		{
+		std::vector<path_step> &path = tree->path;
+		path.clear();
+
+		/*
+			Walk down to the node above the leaves, remembering the way.  As soon as the next node is known start loading its children
+			so that the misses overlap each other (and the bookkeeping here) instead of stalling closest() once per child.
 		*/
-		centroid->fused_subtract_divide(*data, (float)(leaves_below_this_point + 1));
-		leaves_below_this_point++;
+		node *current = this;
+		current->enter(tree, data, weight);
+		while (!current->child[0]->isleaf())
+			{
+			if (tree->triangle_pruning && current->inner->child_distance == nullptr)
+				current->compute_child_distances(tree, memory);
+
+			path_step step;
+			step.parent = current;
+			step.which_child = current->closest(&tree->counters, data, &step.distance);
+			current = current->child[step.which_child];
+			if (!current->child[0]->isleaf())
+				current->prefetch_children();
+			step.child_leaves = current->leaves_below_this_point;
+			path.push_back(step);
+
+			current->enter(tree, data, weight);
+			}
+
+		/*
+			Add to the leaf then walk back up, replacing split nodes and updating the centroids
+		*/
+		bool did_split = current->add_to_leaf(tree, memory, data, weight, replacement);
+		did_split = current->leave(tree, memory, data, weight, did_split, replacement);
+
+		while (!path.empty())
+			{
+			const path_step &step = path.back();
+			node *parent = step.parent;
+
+			if (did_split)
+				did_split = parent->replace_child(tree, memory, step.which_child, replacement);
+			else if (parent->inner->child_distance != nullptr)
+				{
+				/*
+					Adding data to the child moved its centroid by w * |data - centroid| / (n + w) (see leave()), once it has moved too
+					far recompute its distances to its siblings.  A lazy centroid has not moved yet, refresh() adds the distance it
+					does move
+				*/
+				float *drift = parent->child_drift();
+				if (tree->lazy_batch == 0)
+					drift[step.which_child] += sqrtf(step.distance) * weight / (step.child_leaves + weight);
+				if (drift[step.which_child] > tree->triangle_refresh * parent->child_nearest()[step.which_child])
+					parent->update_child_distances(tree, step.which_child);
+				}
+			did_split = parent->leave(tree, memory, data, weight, did_split, replacement);
+			path.pop_back();
+			}
 
 		/*
 			Return whether or not we caused a split, and therefore replacement is necessary
@@ -322,6 +1414,645 @@ namespace k_tree
 		return did_split;
 		}
 
+	/*
+		NODE::UPDATE_CENTROID()
+		-----------------------
+		Account for data[0..count-1] having been added below this node.  The vectors are added to the sum (with running sums) or to
+		the sum of pending vectors, which costs one vector add each, then the centroid is moved once by refresh() (unless
+		context::lazy_batch says to wait).
+	*/
+	void node::update_centroid(context *tree, allocator *memory, object *const *data, size_t count)
+		{
+		if (count == 0)
+			return;
+
+		if (!tree->running_sums)
+			{
+			if (inner->pending == nullptr)
+				inner->pending = centroid->new_object(memory);
+			if (inner->pending_count == 0)
+				inner->pending->zero();
+			}
+
+		object *total = tree->running_sums ? inner->sum : inner->pending;
+		for (size_t which = 0; which < count; which++)
+			*total += *data[which];
+
+		leaves_below_this_point += count;
+		inner->pending_count += count;
+		if (inner->pending_count >= tree->lazy_batch)
+			refresh(tree);
+		}
+
+	/*
+		NODE::TAKE_BACK()
+		-----------------
+		Undo update_centroid() for data[0..count-1], which have been given to this node but not placed below it, because it is about
+		to be split.  Only the count and the sum are corrected, as split() uses them (with running sums) but the centroid of this
+		node is about to be replaced.
+	*/
+	void node::take_back(context *tree, object *const *data, size_t count)
+		{
+		leaves_below_this_point -= count;
+		if (tree->running_sums)
+			for (size_t which = 0; which < count; which++)
+				inner->sum->fused_multiply_add(*data[which], -1.0);
+		}
+
+	/*
+		NODE::ADOPT_SPLIT()
+		-------------------
+		child[which] has split into the nodes in replacement and given back the vectors in returned, which it had not placed.  Put
+		the new nodes in place.  Returns whether or not that split this node, in which case returned is moved to leftover (for the
+		node above) and replacement holds the nodes that replace this node.  Otherwise returned must still be placed below here.
+	*/
+	bool node::adopt_split(context *tree, allocator *memory, size_t which, std::vector<object *> &returned, std::vector<object *> &leftover, std::vector<node *> &replacement)
+		{
+		bool will_split = must_split(tree, replacement.size() - 1);
+
+		if (will_split)
+			take_back(tree, returned.data(), returned.size());
+
+		replace_child(tree, memory, which, replacement);
+
+		if (will_split)
+			{
+			leftover.insert(leftover.end(), returned.begin(), returned.end());
+			returned.clear();
+			}
+
+		return will_split;
+		}
+
+	/*
+		NODE::DISTRIBUTE()
+		------------------
+		Pass the vectors in work, which this node has already accounted for, down to its children.  Each vector is routed to its
+		closest child, then the vectors are grouped by child (with a counting sort, keeping their order) and each group is passed
+		down together, so each node on the way is visited (and its centroid moved) once per batch rather than once per vector.  If
+		a child splits then the vectors it did not place are routed again.  Returns whether or
+		not this node was split, in which case the vectors not placed are added to leftover and the node above must replace this
+		node with the nodes in replacement.  work is destroyed.
+	*/
+	bool node::distribute(context *tree, allocator *memory, std::vector<object *> &work, std::vector<object *> &leftover, std::vector<node *> &replacement)
+		{
+		if (child[0]->isleaf())
+			{
+			/*
+				Add the vectors one at a time until they are all here or this node overflows
+			*/
+			for (size_t placed = 0; placed < work.size(); placed++)
+				{
+				if (tree->absorb_radius != 0 && absorb(tree, memory, work[placed], 1))
+					continue;
+				child[children] = new_node(tree, memory, work[placed]);
+				child[children++]->parent = this;
+				if (must_split(tree))
+					{
+					take_back(tree, &work[placed + 1], work.size() - placed - 1);
+					leftover.insert(leftover.end(), work.begin() + placed + 1, work.end());
+					split(tree, memory, child, children, replacement);
+					return true;
+					}
+				}
+			return false;
+			}
+
+		if (tree->triangle_pruning && inner->child_distance == nullptr)
+			compute_child_distances(tree, memory);
+
+		std::vector<size_t> chosen;
+		std::vector<float> distance;
+		std::vector<size_t> order;
+		std::vector<size_t> group_start;
+		std::vector<object *> grouped;
+		std::vector<object *> returned;
+		std::vector<object *> again;
+		while (!work.empty())
+			{
+			/*
+				Choose the closest child for each vector then group the vectors by child
+			*/
+			size_t remaining = work.size();
+			chosen.resize(remaining);
+			distance.resize(remaining);
+			group_start.assign(children + 1, 0);
+			for (size_t which = 0; which < remaining; which++)
+				{
+				chosen[which] = closest(&tree->counters, work[which], &distance[which]);
+				group_start[chosen[which] + 1]++;
+				}
+			for (size_t group = 1; group <= children; group++)
+				group_start[group] += group_start[group - 1];
+
+			order.resize(remaining);
+			grouped.resize(remaining);
+			std::vector<size_t> next(group_start.begin(), group_start.end() - 1);
+			for (size_t which = 0; which < remaining; which++)
+				order[next[chosen[which]]++] = which;
+			for (size_t position = 0; position < remaining; position++)
+				grouped[position] = work[order[position]];
+
+			/*
+				Pass each group down to its child.  If a child splits then the vectors it gives back are routed again once the other
+				groups have gone down (a split only adds children, so the other groups still have the right child)
+			*/
+			again.clear();
+			size_t groups = group_start.size() - 1;
+			for (size_t which_child = 0; which_child < groups; which_child++)
+				{
+				size_t group_size = group_start[which_child + 1] - group_start[which_child];
+				if (group_size == 0)
+					continue;
+
+				size_t child_leaves = child[which_child]->leaves_below_this_point;
+				returned.clear();
+				if (child[which_child]->add_batch_to_node(tree, memory, &grouped[group_start[which_child]], group_size, returned, replacement))
+					{
+					/*
+						If this node splits then everything not yet placed goes back up, including the groups still to go
+					*/
+					again.insert(again.end(), returned.begin(), returned.end());
+					size_t to_route_again = again.size();
+					again.insert(again.end(), grouped.begin() + group_start[which_child + 1], grouped.end());
+					if (adopt_split(tree, memory, which_child, again, leftover, replacement))
+						return true;
+					again.resize(to_route_again);
+					}
+				else if (inner->child_distance != nullptr)
+					{
+					/*
+						Each vector moved the child's centroid by at most its distance / (n + 1), see add_to_node() and leave()
+					*/
+					float moved = 0;
+					for (size_t position = group_start[which_child]; position < group_start[which_child + 1]; position++)
+						moved += sqrtf(distance[order[position]]);
+					float *drift = child_drift();
+					drift[which_child] += moved / (child_leaves + 1);
+					if (drift[which_child] > tree->triangle_refresh * child_nearest()[which_child])
+						update_child_distances(tree, which_child);
+					}
+				}
+
+			work.swap(again);
+			}
+
+		/*
+			If this node is over-full from an earlier insert and we can now split it, then do so
+		*/
+		if (must_split(tree))
+			{
+			split(tree, memory, child, children, replacement);
+			return true;
+			}
+
+		return false;
+		}
+
+	/*
+		NODE::ADD_BATCH_TO_NODE()
+		-------------------------
+		Add data[0..count-1] to the tree at or below this point.  This node accounts for them straight away (see update_centroid()).
+		If context::buffer_size is set and the children of this node are nodes then the vectors wait in this node's buffer until it
+		is full, and are then passed down together (see distribute()).  Returns whether or not there was a split, in which case the
+		vectors not placed are added to leftover and the node above must replace this node with the nodes in replacement.
+	*/
+	bool node::add_batch_to_node(context *tree, allocator *memory, object *const *data, size_t count, std::vector<object *> &leftover, std::vector<node *> &replacement)
+		{
+		K_TREE_COUNT(tree->counters.nodes_visited++);
+		update_centroid(tree, memory, data, count);
+
+		if (tree->buffer_size != 0 && !child[0]->isleaf())
+			{
+			if (inner->buffer == nullptr)
+				inner->buffer = new (memory->malloc(sizeof(*inner->buffer) * tree->buffer_size)) object *[tree->buffer_size];
+
+			if (inner->buffered + count <= tree->buffer_size)
+				{
+				std::copy(data, data + count, inner->buffer + inner->buffered);
+				inner->buffered += count;
+				return false;
+				}
+
+			/*
+				The buffer is full so it goes down with the new vectors
+			*/
+			K_TREE_COUNT(tree->counters.buffer_flushes++);
+			std::vector<object *> work(inner->buffer, inner->buffer + inner->buffered);
+			work.insert(work.end(), data, data + count);
+			inner->buffered = 0;
+			return distribute(tree, memory, work, leftover, replacement);
+			}
+
+		std::vector<object *> work(data, data + count);
+		return distribute(tree, memory, work, leftover, replacement);
+		}
+
+	/*
+		NODE::FLUSH_BUFFERS()
+		---------------------
+		Empty the buffers at and below this node, so that every vector is below a node directly above the vectors.  Returns whether or
+		not there was a split, in which case the vectors not placed are added to leftover and the node above must replace this node
+		with the nodes in replacement.
+	*/
+	bool node::flush_buffers(context *tree, allocator *memory, std::vector<object *> &leftover, std::vector<node *> &replacement)
+		{
+		if (child[0]->isleaf())
+			return false;
+
+		if (inner->buffered != 0)
+			{
+			K_TREE_COUNT(tree->counters.buffer_flushes++);
+			std::vector<object *> work(inner->buffer, inner->buffer + inner->buffered);
+			inner->buffered = 0;
+			if (distribute(tree, memory, work, leftover, replacement))
+				return true;
+			}
+
+		/*
+			A split below here puts new nodes into this node and gives back vectors to be placed, so start again after one
+		*/
+		std::vector<object *> returned;
+		size_t which_child = 0;
+		while (which_child < children)
+			{
+			returned.clear();
+			if (!child[which_child]->flush_buffers(tree, memory, returned, replacement))
+				which_child++;
+			else
+				{
+				if (adopt_split(tree, memory, which_child, returned, leftover, replacement))
+					return true;
+				if (distribute(tree, memory, returned, leftover, replacement))
+					return true;
+				which_child = 0;
+				}
+			}
+
+		return false;
+		}
+
+	/*
+		NODE::SPLIT_OVERFULL()
+		----------------------
+		Split every node at or below this point that has more than max_children children (see context::split_budget).  The buffers
+		must be empty.  Returns whether or not this node was split, in which case the node above must replace it with the nodes in
+		replacement
+	*/
+	bool node::split_overfull(context *tree, allocator *memory, std::vector<node *> &replacement)
+		{
+		/*
+			Splitting an over-full node need not leave halves that are within max_children, so look at each child again until it
+			does not split (the other halves go on the end and are visited in turn)
+		*/
+		if (!child[0]->isleaf())
+			{
+			for (size_t which = 0; which < children; )
+				{
+				if (!child[which]->split_overfull(tree, memory, replacement))
+					which++;
+				else if (replace_child(tree, memory, which, replacement))
+					return true;
+				}
+			}
+
+		if (children > max_children)
+			{
+			split(tree, memory, child, children, replacement);
+			return true;
+			}
+
+		return false;
+		}
+
+	/*
+		NODE::LOCATE()
+		--------------
+		Find the leaf holding data (compared by address) at or below this node, putting the nodes passed through (and the child taken at
+		each) in path.  The path an insert would take is tried first, as the vector is usually still there, then the subtree is
+		searched nearest centroid first (see search_for()).  Returns whether or not data was found
+	*/
+	bool node::locate(context *tree, object *data, std::vector<path_step> &path)
+		{
+		path_step step;
+
+		path.clear();
+		step.distance = 0;
+		step.child_leaves = 0;
+
+		step.parent = this;
+		while (!step.parent->child[0]->isleaf())
+			{
+			step.which_child = step.parent->closest(&tree->counters, data);
+			path.push_back(step);
+			step.parent = step.parent->child[step.which_child];
+			}
+		for (step.which_child = 0; step.which_child < step.parent->children; step.which_child++)
+			if (step.parent->child[step.which_child]->centroid == data)
+				{
+				path.push_back(step);
+				return true;
+				}
+
+		path.clear();
+		return search_for(tree, data, path);
+		}
+
+	/*
+		NODE::SEARCH_FOR()
+		------------------
+		Search for the leaf holding data (compared by address), putting the path to it in path.  The nodes are visited closest centroid
+		first, so a vector that has drifted away from the path an insert would take is usually found after a few nodes, but if it is
+		not there the whole subtree is searched.  Returns whether or not data was found
+	*/
+	bool node::search_for(context *tree, object *data, std::vector<path_step> &path)
+		{
+		/*
+			Each node reached, the node it was reached from (as an index into reached), and which child of that node it is
+		*/
+		struct way
+			{
+			node *at;
+			size_t from;
+			size_t which_child;
+			};
+		std::vector<way> reached;
+		std::priority_queue<std::pair<float, size_t>, std::vector<std::pair<float, size_t>>, std::greater<std::pair<float, size_t>>> frontier;
+
+		reached.push_back(way{this, 0, 0});
+		frontier.push(std::make_pair(0.0f, 0));
+		while (!frontier.empty())
+			{
+			size_t current = frontier.top().second;
+			node *at = reached[current].at;
+			frontier.pop();
+
+			if (at->child[0]->isleaf())
+				{
+				for (size_t which = 0; which < at->children; which++)
+					if (at->child[which]->centroid == data)
+						{
+						/*
+							Found, so follow the way back to the top then reverse it
+						*/
+						path_step step;
+						step.distance = 0;
+						step.child_leaves = 0;
+						step.parent = at;
+						step.which_child = which;
+						path.push_back(step);
+						for (; current != 0; current = reached[current].from)
+							{
+							step.parent = reached[reached[current].from].at;
+							step.which_child = reached[current].which_child;
+							path.push_back(step);
+							}
+						std::reverse(path.begin(), path.end());
+						return true;
+						}
+				}
+			else
+				{
+				K_TREE_COUNT(tree->counters.distance_computations += at->children);
+				for (size_t which = 0; which < at->children; which++)
+					{
+					frontier.push(std::make_pair(data->distance_squared(at->child[which]->centroid), reached.size()));
+					reached.push_back(way{at->child[which], current, which});
+					}
+				}
+			}
+
+		return false;
+		}
+
+	/*
+		NODE::FORGET()
+		--------------
+		Account for data (of weight w) having been removed from below this node.  This is the inverse of the update in leave(): with
+		n the new count
+			M - delta = (M * (n + w) - w * X) / n
+			delta = w * (X - M) / n
+		so the centroid moves by -w * (X - M) / n.  Any deferred updates are applied first (see refresh()).
+	*/
+	void node::forget(context *tree, object *data, size_t weight)
+		{
+		if (inner->pending_count != 0)
+			refresh(tree);
+
+		leaves_below_this_point -= weight;
+		if (tree->running_sums)
+			inner->sum->fused_multiply_add(*data, -(float)weight);
+
+		if (leaves_below_this_point == 0)
+			return;				// this node is about to be removed
+
+		if (tree->running_sums)
+			centroid->scale(*inner->sum, (float)1.0 / leaves_below_this_point);
+		else
+			centroid->fused_subtract_divide(*data, -(float)leaves_below_this_point / weight);
+		}
+
+	/*
+		NODE::SHIFT()
+		-------------
+		Account for a vector below this node changing from from to to (from must still hold the old values).  With n vectors below
+		this node the centroid moves by w * (to - from) / n, where w is the weight of the vector
+	*/
+	void node::shift(context *tree, object *from, object *to, size_t weight)
+		{
+		if (inner->pending_count != 0)
+			refresh(tree);
+
+		if (tree->running_sums)
+			{
+			inner->sum->fused_multiply_add(*to, (float)weight);
+			inner->sum->fused_multiply_add(*from, -(float)weight);
+			centroid->scale(*inner->sum, (float)1.0 / leaves_below_this_point);
+			}
+		else
+			{
+			centroid->fused_multiply_add(*to, (float)weight / leaves_below_this_point);
+			centroid->fused_multiply_add(*from, -(float)weight / leaves_below_this_point);
+			}
+		}
+
+	/*
+		NODE::RECYCLE()
+		---------------
+		This node has been taken out of the tree (split, merged, or erased) so keep it for reuse by new_node().  Its child_distance
+		matrix is kept separately as it must be recomputed before it is used again (see compute_child_distances())
+	*/
+	void node::recycle(context *tree)
+		{
+		if (isleaf())
+			{
+			if (tree->absorb_radius != 0)
+				tree->micro_clusters--;
+			tree->spare_leaves.push_back(this);
+			}
+		else
+			{
+			if (inner->child_distance != nullptr)
+				{
+				tree->spare_distances.push_back(std::make_pair(inner->capacity, inner->child_distance));
+				inner->child_distance = nullptr;
+				}
+			tree->spare_nodes.push_back(this);
+			}
+		}
+
+	/*
+		NODE::REMOVE_CHILD()
+		--------------------
+		Remove child[which] from this node (the last child takes its place)
+	*/
+	void node::remove_child(context *tree, allocator *memory, size_t which)
+		{
+		child[which] = child[--children];
+
+		if (inner->child_distance != nullptr && children != 0)
+			compute_child_distances(tree, memory);
+		}
+
+	/*
+		NODE::UNDERFLOWS()
+		------------------
+		Returns whether or not this node has too few children and should be merged with a sibling (see context::min_fill)
+	*/
+	bool node::underflows(context *tree) const
+		{
+		size_t minimum = std::max((size_t)1, (size_t)(tree->min_fill * max_children));
+
+		return children < minimum;
+		}
+
+	/*
+		NODE::REBALANCE()
+		-----------------
+		child[which] has too few children (see underflows()).  If it and its nearest sibling fit in one node then the sibling takes its
+		children and it is removed.  Otherwise it takes the children of the sibling closest to its own centroid until it has enough.
+		Neither of these changes the vectors below this node, so this node's centroid does not change, but this node may now underflow
+	*/
+	void node::rebalance(context *tree, allocator *memory, size_t which)
+		{
+		node *under = child[which];
+
+		if (under->children == 0)
+			{
+			remove_child(tree, memory, which);
+			under->recycle(tree);
+			return;
+			}
+
+		if (children == 1)
+			return;			// no siblings to merge with
+
+		/*
+			Find the nearest sibling
+		*/
+		size_t nearest = which == 0 ? 1 : 0;
+		float nearest_distance = under->centroid->distance_squared(child[nearest]->centroid);
+		K_TREE_COUNT(tree->counters.distance_computations += children - 1);
+		for (size_t sibling = nearest + 1; sibling < children; sibling++)
+			if (sibling != which)
+				{
+				float distance = under->centroid->distance_squared(child[sibling]->centroid, nearest_distance);
+				if (distance < nearest_distance)
+					{
+					nearest_distance = distance;
+					nearest = sibling;
+					}
+				}
+		node *sibling = child[nearest];
+
+		/*
+			The centroids of the two nodes are recomputed from those of their children, so those must be up to date
+		*/
+		for (size_t member = 0; member < under->children; member++)
+			under->child[member]->refresh(tree);
+		for (size_t member = 0; member < sibling->children; member++)
+			sibling->child[member]->refresh(tree);
+
+		if (under->children + sibling->children <= sibling->max_children)
+			{
+			/*
+				Merge
+			*/
+			K_TREE_COUNT(tree->counters.merges++);
+			for (size_t member = 0; member < under->children; member++)
+				{
+				under->child[member]->parent = sibling;
+				sibling->child[sibling->children++] = under->child[member];
+				}
+			sibling->dead_below += under->dead_below;
+			sibling->compute_mean(tree, memory);
+			if (sibling->inner->child_distance != nullptr)
+				sibling->compute_child_distances(tree, memory);
+
+			remove_child(tree, memory, which);
+			under->recycle(tree);
+			return;
+			}
+
+		/*
+			Redistribute: move the sibling's children closest to under's centroid across until under is no longer short
+		*/
+		K_TREE_COUNT(tree->counters.redistributions++);
+		size_t minimum = std::max((size_t)1, (size_t)(tree->min_fill * under->max_children));		// as in underflows(), the order of the level below
+		std::vector<std::pair<float, size_t>> order;
+		for (size_t member = 0; member < sibling->children; member++)
+			order.push_back(std::make_pair(under->centroid->distance_squared(sibling->child[member]->centroid), member));
+		K_TREE_COUNT(tree->counters.distance_computations += sibling->children);
+
+		size_t spare = sibling->children > minimum ? sibling->children - minimum : 0;
+		size_t move = std::min(minimum - under->children, spare);
+		std::partial_sort(order.begin(), order.begin() + move, order.end());
+		std::sort(order.begin(), order.begin() + move, [](const std::pair<float, size_t> &a, const std::pair<float, size_t> &b) { return a.second > b.second; });
+		for (size_t moved = 0; moved < move; moved++)
+			{
+			/*
+				Highest index first so that filling each hole with the last child does not move a child that is still to go
+			*/
+			size_t member = order[moved].second;
+			sibling->child[member]->parent = under;
+			under->dead_below += sibling->child[member]->dead_below;
+			sibling->dead_below -= sibling->child[member]->dead_below;
+			under->child[under->children++] = sibling->child[member];
+			sibling->child[member] = sibling->child[--sibling->children];
+			}
+
+		under->compute_mean(tree, memory);
+		sibling->compute_mean(tree, memory);
+		if (under->inner->child_distance != nullptr)
+			under->compute_child_distances(tree, memory);
+		if (sibling->inner->child_distance != nullptr)
+			sibling->compute_child_distances(tree, memory);
+		if (inner->child_distance != nullptr)
+			{
+			update_child_distances(tree, which);
+			update_child_distances(tree, nearest);
+			}
+		}
+
+	/*
+		NODE::COLLECT_DEAD()
+		--------------------
+		Append every tombstoned vector (leaf) at or below this node to into
+	*/
+	void node::collect_dead(std::vector<node *> &into)
+		{
+		if (isleaf())
+			{
+			if (dead_below != 0)
+				into.push_back(this);
+			return;
+			}
+
+		for (size_t which = 0; which < children; which++)
+			if (child[which]->dead_below != 0)
+				child[which]->collect_dead(into);
+		}
+
 	/*
 		NODE::TEXT_RENDER()
 		-------------------
@@ -8,7 +8,10 @@
 
 #include <stdint.h>
 
+#include <vector>
+
 #include "object.h"
+#include "context.h"
 #include "allocator.h"
 
 namespace k_tree
@@ -24,13 +27,59 @@ namespace k_tree
 
 		private:
 			static constexpr float float_resolution = (float)0.000001;														// floats his close are considered equal
+			static constexpr float triangle_slack = (float)1.0001;															// safety margin for rounding errors when pruning with the triangle inequality
+			static constexpr float pddp_tolerance = (float)0.0001;															// power iteration stops when the direction moves less than this (1 - cosine)
+			static constexpr size_t pddp_max_iterations = 100;																// power iteration always stops after this many iterations
+
+		public:
+			/*
+				CLASS NODE::INTERIOR
+				--------------------
+				The state kept only by nodes with children.  The leaves (which are most of the nodes) do not have one, so they do not
+				pay for it
+			*/
+			class interior
+				{
+				public:
+					size_t capacity;						// the number of slots in child (max_children + 1, plus context::overflow_slack)
+					object *sum;							// if running sums, the sum of the vectors below this node (so the centroid is sum / leaves_below_this_point)
+					object *pending;						// if lazy centroids (and not running sums), the sum of the vectors added since the centroid was last computed
+					size_t pending_count;				// if lazy centroids, the number of vectors added since the centroid was last computed (the node is dirty if non-zero)
+					object **buffer;						// if buffered insertion, the vectors waiting to be passed down to the children (see add_batch_to_node())
+					size_t buffered;						// if buffered insertion, the number of vectors in buffer
+					float *child_distance;				// if triangle pruning, the distances between the centroids of the children, then each child's drift and nearest sibling distance (see closest())
+
+				public:
+					/*
+						NODE::INTERIOR::INTERIOR()
+						--------------------------
+					*/
+					interior() :
+						capacity(0),
+						sum(nullptr),
+						pending(nullptr),
+						pending_count(0),
+						buffer(nullptr),
+						buffered(0),
+						child_distance(nullptr)
+						{
+						/* Nothing */
+						}
+				};
 
 		public:
 			size_t max_children;					//	the order of the tree at this node (constant per tree as it propegates when a new node is created)
 			size_t children;						// the number of children of this node
 			node **child;							// the immediate descendants of this node
+			node *parent;							// the node this node is a child of (nullptr at the root)
 			object *centroid;						// the centroid of this cluster
-			size_t leaves_below_this_point;	// the number of leaves below this node
+			size_t leaves_below_this_point;	// the number of leaves below this node (each counted as its weight, see k_tree::push_back_weighted())
+			size_t dead_below;					// the number of tombstoned vectors below this node (for a vector, its weight if it has been tombstoned, see k_tree::tombstone())
+			union
+				{
+				interior *inner;					// if this node has children, the state only they need (allocated with the node)
+				float scatter;						// if a micro-cluster (see context::absorb_radius), the sum of the squared distances from the vectors absorbed to centroid
+				};
 
 		private:
 			/*
@@ -39,18 +88,187 @@ namespace k_tree
 			*/
 			node();
 
+			/*
+				NODE::CHILD_DRIFT()
+				-------------------
+				Return the array of distances each child's centroid has moved since its row of child_distance was computed
+			*/
+			float *child_drift(void) const
+				{
+				return inner->child_distance + inner->capacity * inner->capacity;
+				}
+
+			/*
+				NODE::CHILD_NEAREST()
+				---------------------
+				Return the array of distances from each child to its nearest sibling (when its row of child_distance was computed)
+			*/
+			float *child_nearest(void) const
+				{
+				return child_drift() + inner->capacity;
+				}
+
+			/*
+				NODE::SCRATCH_VECTOR()
+				----------------------
+				Return one of the tree's scratch vectors (used as workspace by split()), allocating it if this is its first use
+			*/
+			object *scratch_vector(context *tree, allocator *memory, size_t which) const;
+
+			/*
+				NODE::SEED()
+				------------
+				Choose the two initial centroids for two_means() from members[0..count-1] using context::split_method
+			*/
+			void seed(context *tree, node *const *members, size_t count, object *centroid_1, object *centroid_2) const;
+
+			/*
+				NODE::PDDP()
+				------------
+				Split members[0..count-1] on their principal direction (found by power iteration), setting the two centroids to the means
+				of the halves.  Returns the number of power iterations
+			*/
+			size_t pddp(context *tree, allocator *memory, node *const *members, size_t count, object *centroid_1, object *centroid_2, size_t *assignment) const;
+
+			/*
+				NODE::K_MEANS()
+				---------------
+				Lloyd's algorithm with ways centroids over members[0..count-1] (for multi-way splits), leaving the centroids in the scratch
+				vectors from first_centroid onwards.  Returns the number of iterations
+			*/
+			size_t k_means(context *tree, allocator *memory, node *const *members, size_t count, size_t ways, size_t first_centroid, size_t *assignment) const;
+
+			/*
+				NODE::TWO_MEANS()
+				-----------------
+				Lloyd's algorithm over members[0..count-1]: assign each member to its closest centroid then move the centroids to the mean of their members, repeating
+				until the sum of squared distances stops falling.  Returns the number of iterations
+			*/
+			size_t two_means(context *tree, node *const *members, size_t count, object *centroid_1, object *centroid_2, size_t *assignment) const;
+
+			/*
+				NODE::TWO_MEANS_BOUNDED()
+				-------------------------
+				Hamerly's accelerated k-means (for k=2) over members[0..count-1], members are only re-examined when their distance bounds say they might have
+				changed cluster.  Returns the number of iterations
+			*/
+			size_t two_means_bounded(context *tree, allocator *memory, node *const *members, size_t count, object *centroid_1, object *centroid_2, size_t *assignment) const;
+
+			/*
+				NODE::COMPUTE_CHILD_DISTANCES()
+				-------------------------------
+				Allocate (if necessary) and fill in the matrix of distances between the children of this node
+			*/
+			void compute_child_distances(context *tree, allocator *memory);
+
+			/*
+				NODE::UPDATE_CHILD_DISTANCES()
+				------------------------------
+				Recompute the distances from the given child to its siblings
+			*/
+			void update_child_distances(context *tree, size_t which);
+
+			/*
+				NODE::MUST_SPLIT()
+				------------------
+				Returns whether or not this node must be split if it has extra more children than it does now (see context::split_budget)
+			*/
+			bool must_split(context *tree, size_t extra = 0) const;
+
+			/*
+				NODE::REPLACE_CHILD()
+				---------------------
+				Replace child[which] with the nodes it was split into (in replacement).  Returns whether or not that overflowed this node,
+				in which case this node has been split and replacement holds the nodes that replace it
+			*/
+			bool replace_child(context *tree, allocator *memory, size_t which, std::vector<node *> &replacement);
+
+			/*
+				NODE::ABSORB()
+				--------------
+				Fold data (weight vectors) into the nearest of the leaves directly below this node if it is within
+				context::absorb_radius of it.  Returns whether or not data was absorbed (if not, it needs a leaf of its own)
+			*/
+			bool absorb(context *tree, allocator *memory, object *data, size_t weight);
+
+			/*
+				NODE::RECYCLE()
+				---------------
+				This node has been taken out of the tree so keep it for reuse by new_node()
+			*/
+			void recycle(context *tree);
+
+			/*
+				NODE::REMOVE_CHILD()
+				--------------------
+				Remove child[which] from this node (the last child takes its place)
+			*/
+			void remove_child(context *tree, allocator *memory, size_t which);
+
+			/*
+				NODE::SEARCH_FOR()
+				------------------
+				Search for the leaf holding data (nearest centroids first) putting the path to it in path.  Returns whether or not data
+				was found
+			*/
+			bool search_for(context *tree, object *data, std::vector<path_step> &path);
+
+			/*
+				NODE::ENTER()
+				-------------
+				Account for data (weight vectors) passing through this node on its way down (see add_to_node())
+			*/
+			void enter(context *tree, object *data, size_t weight);
+
+			/*
+				NODE::LEAVE()
+				-------------
+				Finish adding data below this node on the way back up (see add_to_node()).  Returns whether or not this node split
+			*/
+			bool leave(context *tree, allocator *memory, object *data, size_t weight, bool did_split, std::vector<node *> &replacement);
+
+			/*
+				NODE::INCLUDE()
+				---------------
+				Move the centroid to account for data (weight vectors) having been added below this node (see leave())
+			*/
+			void include(context *tree, allocator *memory, object *data, size_t weight);
+
+			/*
+				NODE::TAKE_BACK()
+				-----------------
+				Undo update_centroid() for data[0..count-1], which were not placed below this node because it is about to be split
+			*/
+			void take_back(context *tree, object *const *data, size_t count);
+
+			/*
+				NODE::ADOPT_SPLIT()
+				-------------------
+				Put in place the nodes child[which] split into, and take the vectors it gave back.  Returns whether or not this node split
+				as a result, in which case returned is moved to leftover
+			*/
+			bool adopt_split(context *tree, allocator *memory, size_t which, std::vector<object *> &returned, std::vector<object *> &leftover, std::vector<node *> &replacement);
+
+			/*
+				NODE::DISTRIBUTE()
+				------------------
+				Pass the vectors in work (already accounted for by this node) down to the children.  Returns whether or not this node
+				split, in which case the vectors not placed are added to leftover
+			*/
+			bool distribute(context *tree, allocator *memory, std::vector<object *> &work, std::vector<object *> &leftover, std::vector<node *> &replacement);
+
 		public:
 			/*
 				NODE::NEW_NODE()
 				----------------
 			*/
-			node *new_node(allocator *memory, object *data) const;
+			node *new_node(context *tree, allocator *memory, object *data) const;
 
 			/*
 				NODE::NEW_NODE()
 				----------------
 			*/
-			node *new_node(allocator *memory, node *first_child) const;
+			node *new_node(context *tree, allocator *memory, node *first_child) const;
 
 			/*
 				NODE::ISLEAF()
@@ -62,9 +280,18 @@ namespace k_tree
 			/*
 				NODE::CLOSEST()
 				---------------
-				Returns the index of the child closest to the parameter what
+				Returns the index of the child closest to the parameter what, and (if distance is not nullptr) the square of the distance to it.
+				If the distances between the children are known (child_distance) then the triangle inequality is used to skip children that
+				cannot be closer than the closest so far.  The distances computed and skipped are added to counters.
+			*/
+			size_t closest(statistics *counters, object *what, float *distance = nullptr) const;
+
+			/*
+				NODE::PREFETCH_CHILDREN()
+				-------------------------
+				Start loading the children and their centroids into the cache ahead of a call to closest()
 			*/
-			size_t closest(object *what) const;
+			void prefetch_children(void) const;
 
 			/*
 				NODE::COMPUTE_MEAN()
@@ -73,30 +300,128 @@ namespace k_tree
 				same number of children and this resulting centroid should be the middle of the leaves not the middle of the children.  This also
 				recomputes that count from the children (which might have recently changed)
 			*/
-			void compute_mean(void);
+			void compute_mean(context *tree, allocator *memory);
+
+			/*
+				NODE::REFRESH()
+				---------------
+				If this node is dirty (see context::lazy_batch) then apply its deferred updates to its centroid
+			*/
+			void refresh(context *tree);
+
+			/*
+				NODE::REFRESH_SUBTREE()
+				-----------------------
+				Refresh every dirty node at or below this point
+			*/
+			void refresh_subtree(context *tree);
 
 			/*
 				NODE::SPLIT()
 				-------------
-				Split this node into two new children
+				Split the nodes in from[0..count-1] into context::split_ways new nodes (returned in into), using a sample of them if
+				context::split_sample says so
 			*/
-			void split(allocator *memory, node **child_1_out, node **child_2_out) const;
+			void split(context *tree, allocator *memory, node *const *from, size_t count, std::vector<node *> &into) const;
 
 			/*
 				NODE::ADD_TO_LEAF()
 				-------------------
-				Add the given data to the current leaf node.
-				Returns whether or not there was a split (and so the node above must do a replacement and an add)
+				Add the given data to the current leaf node, as weight vectors.
+				Returns whether or not there was a split (and so the node above must replace this node with the nodes in replacement)
 			*/
-			bool add_to_leaf(allocator *memory, object *data, node **child_1, node **child_2);
+			bool add_to_leaf(context *tree, allocator *memory, object *data, size_t weight, std::vector<node *> &replacement);
 
 			/*
 				NODE::ADD_TO_NODE()
 				-------------------
-				Add the given data to the current tree at or below this point.
-				Returns whether or not there was a split (and so the node above must do a replacement and an add)
+				Add the given data to the current tree at or below this point, counting it as weight vectors (all at the same place).
+				Returns whether or not there was a split (and so the node above must replace this node with the nodes in replacement)
+			*/
+			bool add_to_node(context *tree, allocator *memory, object *data, size_t weight, std::vector<node *> &replacement);
+
+			/*
+				NODE::UPDATE_CENTROID()
+				-----------------------
+				Account for data[0..count-1] having been added below this node: the count and sum are updated for each vector, but the
+				centroid is moved only once (and not at all if context::lazy_batch says to wait)
+			*/
+			void update_centroid(context *tree, allocator *memory, object *const *data, size_t count);
+
+			/*
+				NODE::ADD_BATCH_TO_NODE()
+				-------------------------
+				Add data[0..count-1] to the tree at or below this point, routing them down together (or holding them in this node's
+				buffer, see context::buffer_size).  Returns whether or not there was a split, in which case the vectors not placed are
+				added to leftover and the node above must replace this node with the nodes in replacement
+			*/
+			bool add_batch_to_node(context *tree, allocator *memory, object *const *data, size_t count, std::vector<object *> &leftover, std::vector<node *> &replacement);
+
+			/*
+				NODE::FLUSH_BUFFERS()
+				---------------------
+				Empty the buffers at and below this node.  Returns whether or not there was a split, in which case the vectors not placed
+				are added to leftover and the node above must replace this node with the nodes in replacement
+			*/
+			bool flush_buffers(context *tree, allocator *memory, std::vector<object *> &leftover, std::vector<node *> &replacement);
+
+			/*
+				NODE::SPLIT_OVERFULL()
+				----------------------
+				Split every node at or below this point that has more than max_children children (see context::split_budget).  Returns
+				whether or not this node was split, in which case the node above must replace it with the nodes in replacement
+			*/
+			bool split_overfull(context *tree, allocator *memory, std::vector<node *> &replacement);
+
+			/*
+				NODE::LOCATE()
+				--------------
+				Find the leaf holding data (compared by address) at or below this node, putting the nodes passed through (and the child
+				taken at each) in path.  Returns whether or not data was found
+			*/
+			bool locate(context *tree, object *data, std::vector<path_step> &path);
+
+			/*
+				NODE::COUNT_IN()
+				----------------
+				Account for weight more copies of data, which is already below this node, as an insert passing through would
+			*/
+			void count_in(context *tree, allocator *memory, object *data, size_t weight);
+
+			/*
+				NODE::FORGET()
+				--------------
+				Account for data (weight vectors) having been removed from below this node (the inverse of adding it)
+			*/
+			void forget(context *tree, object *data, size_t weight);
+
+			/*
+				NODE::SHIFT()
+				-------------
+				Account for a vector (of weight vectors) below this node changing from from to to (from must still hold the old values)
+			*/
+			void shift(context *tree, object *from, object *to, size_t weight);
+
+			/*
+				NODE::UNDERFLOWS()
+				------------------
+				Returns whether or not this node has too few children and should be merged with a sibling (see context::min_fill)
+			*/
+			bool underflows(context *tree) const;
+
+			/*
+				NODE::REBALANCE()
+				-----------------
+				child[which] has too few children, so merge it into its nearest sibling or move children across from that sibling
+			*/
+			void rebalance(context *tree, allocator *memory, size_t which);
+
+			/*
+				NODE::COLLECT_DEAD()
+				--------------------
+				Append every tombstoned vector (leaf) at or below this node to into
 			*/
-			bool add_to_node(allocator *memory, object *data, node **child_1, node **child_2);
+			void collect_dead(std::vector<node *> &into);
 
 			/*
 				NODE::TEXT_RENDER()
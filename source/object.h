@@ -12,6 +12,7 @@
 
 #include <atomic>
 #include <iostream>
+#include <string_view>
 
 #include "allocator.h"
 
@@ -56,6 +57,17 @@ namespace k_tree
 				}
 
 		public:
+			/*
+				OBJECT::NEW_EXAMPLE()
+				---------------------
+				Return an object of the given dimensionality (with no vector) from which to make others with new_object().  A k_tree
+				makes its own (see k_tree::get_example_object()), this is for using objects without a tree
+			*/
+			static object *new_example(allocator *allocator, size_t dimensions)
+				{
+				return new (allocator->malloc(sizeof(object))) object(dimensions);
+				}
+
 			/*
 				OBJECT::NEW_OBJECT()
 				--------------------
@@ -145,6 +157,23 @@ namespace k_tree
 				return  _mm256_cvtss_f32(answer);
 				}
 
+			#ifdef __AVX512F__
+				/*
+					SIMD::HORIZONTAL_SUM()
+					----------------------
+					Calculate the horizontal sum of the floats in an AVX-512 register by adding its top half to its bottom half and
+					summing that.  This does the job of horizontal_sum(), whose use of _mm512_extractf64x4_pd() makes GCC warn
+					that an undefined register may be used uninitialized wherever it is inlined
+				*/
+				static float horizontal_sum(__m512 elements)
+					{
+					__m512d halves = _mm512_castps_pd(elements);
+					__m256 bottom = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xFF, halves, 0));
+					__m256 top = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xFF, halves, 1));
+					return horizontal_sum(_mm256_add_ps(bottom, top));
+					}
+			#endif
+
 			/*
 				OBJECT::DISTANCE_L1()
 				---------------------
@@ -162,7 +191,7 @@ namespace k_tree
 						__m512 diff = _mm512_sub_ps(_mm512_loadu_ps(vector + dimension), _mm512_loadu_ps(b->vector + dimension));
 						__m512 result = _mm512_abs_ps(diff);
 
-						total += _mm512_reduce_add_ps(result);
+						total += horizontal_sum(result);
 						}
 				#else
 					for (size_t dimension = 0; dimension < dimensions; dimension += 8)
@@ -199,7 +228,7 @@ namespace k_tree
 						{
 						__m512 diff = _mm512_sub_ps(_mm512_loadu_ps(vector + dimension), _mm512_loadu_ps(b->vector + dimension));
 						__m512 result = _mm512_mul_ps(diff, diff);
-						total += _mm512_reduce_add_ps(result);
+						total += horizontal_sum(result);
 						}
 				#else
 					for (size_t dimension = 0; dimension < dimensions; dimension += 8)
@@ -213,6 +242,38 @@ namespace k_tree
 				return total;
 				}
 
+			/*
+				OBJECT::DISTANCE_SQUARED()
+				--------------------------
+				Return the square of the Euclidean distance between parameters a and b using SIMD operations, but give up as soon as the
+				partial sum exceeds limit (in which case the answer is the partial sum, which is larger than limit)
+			*/
+			float distance_squared(const object *b, float limit)
+				{
+				float total = 0;
+				#ifdef __AVX512F__
+					for (size_t dimension = 0; dimension < dimensions; dimension += 16)
+						{
+						__m512 diff = _mm512_sub_ps(_mm512_loadu_ps(vector + dimension), _mm512_loadu_ps(b->vector + dimension));
+						__m512 result = _mm512_mul_ps(diff, diff);
+						total += horizontal_sum(result);
+						if (total > limit)
+							break;
+						}
+				#else
+					for (size_t dimension = 0; dimension < dimensions; dimension += 8)
+						{
+						__m256 diff = _mm256_sub_ps(_mm256_loadu_ps(vector + dimension), _mm256_loadu_ps(b->vector + dimension));
+						__m256 result = _mm256_mul_ps(diff, diff);
+						total += horizontal_sum(result);
+						if (total > limit)
+							break;
+						}
+
+				#endif
+				return total;
+				}
+
 			/*
 				OBJECT::DISTANCE_SQUARED_LINEAR()
 				---------------------------------
@@ -228,6 +289,24 @@ namespace k_tree
 				return total;
 				}
 
+			/*
+				OBJECT::DOT_PRODUCT()
+				---------------------
+				Return the inner product of this and b using SIMD operations
+			*/
+			float dot_product(const object *b)
+				{
+				float total = 0;
+				#ifdef __AVX512F__
+					for (size_t dimension = 0; dimension < dimensions; dimension += 16)
+						total += horizontal_sum(_mm512_mul_ps(_mm512_loadu_ps(vector + dimension), _mm512_loadu_ps(b->vector + dimension)));
+				#else
+					for (size_t dimension = 0; dimension < dimensions; dimension += 8)
+						total += horizontal_sum(_mm256_mul_ps(_mm256_loadu_ps(vector + dimension), _mm256_loadu_ps(b->vector + dimension)));
+				#endif
+				return total;
+				}
+
 			/*
 				OBJECT::ZERO()
 				--------------
@@ -238,6 +317,17 @@ namespace k_tree
 				memset(vector, 0, sizeof(*vector) * dimensions);
 				}
 
+			/*
+				OBJECT::PREFETCH()
+				------------------
+				Ask the CPU to start loading the vector into the cache (one request per 64-byte line) so that a later use does not stall
+			*/
+			void prefetch(void) const
+				{
+				for (size_t which = 0; which < dimensions; which += 64 / sizeof(*vector))
+					_mm_prefetch((const char *)(vector + which), _MM_HINT_T0);
+				}
+
 			/*
 				OBJECT::OPERATOR=()
 				-------------------
@@ -327,6 +417,79 @@ namespace k_tree
 				#endif
 				}
 
+			/*
+				OBJECT::SCALE()
+				---------------
+				this = operand * constant
+			*/
+			void scale(const object &operand, float constant)
+				{
+				#ifdef __AVX512F__
+					__m512 factor = _mm512_set1_ps(constant);
+					for (size_t dimension = 0; dimension < dimensions; dimension += 16)
+						_mm512_storeu_ps(vector + dimension, _mm512_mul_ps(_mm512_loadu_ps(operand.vector + dimension), factor));
+				#else
+					__m256 factor = _mm256_set1_ps(constant);
+					for (size_t dimension = 0; dimension < dimensions; dimension += 8)
+						_mm256_storeu_ps(vector + dimension, _mm256_mul_ps(_mm256_loadu_ps(operand.vector + dimension), factor));
+				#endif
+				}
+
+			/*
+				OBJECT::ACCUMULATE_AND_SCALE()
+				------------------------------
+				total += operand then this = total * constant, in one pass
+			*/
+			void accumulate_and_scale(object &total, const object &operand, float constant)
+				{
+				#ifdef __AVX512F__
+					__m512 factor = _mm512_set1_ps(constant);
+					for (size_t dimension = 0; dimension < dimensions; dimension += 16)
+						{
+						__m512 sum = _mm512_add_ps(_mm512_loadu_ps(total.vector + dimension), _mm512_loadu_ps(operand.vector + dimension));
+						_mm512_storeu_ps(total.vector + dimension, sum);
+						_mm512_storeu_ps(vector + dimension, _mm512_mul_ps(sum, factor));
+						}
+				#else
+					__m256 factor = _mm256_set1_ps(constant);
+					for (size_t dimension = 0; dimension < dimensions; dimension += 8)
+						{
+						__m256 sum = _mm256_add_ps(_mm256_loadu_ps(total.vector + dimension), _mm256_loadu_ps(operand.vector + dimension));
+						_mm256_storeu_ps(total.vector + dimension, sum);
+						_mm256_storeu_ps(vector + dimension, _mm256_mul_ps(sum, factor));
+						}
+				#endif
+				}
+
+			/*
+				OBJECT::ABSORB()
+				----------------
+				this += (total - this * count) * constant, which with constant = 1 / n moves a mean of n - count vectors to the mean of
+				those and the count vectors whose sum is total
+			*/
+			void absorb(const object &total, float count, float constant)
+				{
+				#ifdef __AVX512F__
+					__m512 weight = _mm512_set1_ps(count);
+					__m512 factor = _mm512_set1_ps(constant);
+					for (size_t dimension = 0; dimension < dimensions; dimension += 16)
+						{
+						__m512 me = _mm512_loadu_ps(vector + dimension);
+						__m512 difference = _mm512_fnmadd_ps(me, weight, _mm512_loadu_ps(total.vector + dimension));
+						_mm512_storeu_ps(vector + dimension, _mm512_fmadd_ps(difference, factor, me));
+						}
+				#else
+					__m256 weight = _mm256_set1_ps(count);
+					__m256 factor = _mm256_set1_ps(constant);
+					for (size_t dimension = 0; dimension < dimensions; dimension += 8)
+						{
+						__m256 me = _mm256_loadu_ps(vector + dimension);
+						__m256 difference = _mm256_fnmadd_ps(me, weight, _mm256_loadu_ps(total.vector + dimension));
+						_mm256_storeu_ps(vector + dimension, _mm256_fmadd_ps(difference, factor, me));
+						}
+				#endif
+				}
+
 			/*
 				OBJECT::UNITTEST()
 				------------------
@@ -357,12 +520,18 @@ namespace k_tree
 				float sum = horizontal_sum(_mm256_loadu_ps(v1));
 //std::cout << "Sum:" << sum << "\n";
 				assert(sum == 36);
+				(void)sum;
 
 
 				float linear = o1->distance_squared_linear(o2);
 				float simd = o1->distance_squared(o2);
 //std::cout << "Linear:" << linear << " SIMD:" << simd << "\n";
 				assert(simd == linear);
+				assert(o1->distance_squared(o2, simd) == simd);
+				assert(o1->distance_squared(o2, 1) > 1);
+				assert(o1->dot_product(o2) == 156);
+				(void)linear;
+				(void)simd;
 
 
 				*o1 += *o2;
@@ -380,6 +549,19 @@ namespace k_tree
 				assert(horizontal_sum(_mm256_loadu_ps(o1->vector)) == 96);
 
 
+				o2->scale(*o1, 0.5);
+				assert(horizontal_sum(_mm256_loadu_ps(o2->vector)) == 48);
+
+
+				o2->accumulate_and_scale(*o1, *o1, 0.25);
+				assert(horizontal_sum(_mm256_loadu_ps(o1->vector)) == 192);
+				assert(horizontal_sum(_mm256_loadu_ps(o2->vector)) == 48);
+
+
+				o2->absorb(*o1, 2, 0.25);
+				assert(horizontal_sum(_mm256_loadu_ps(o2->vector)) == 72);
+
+
 				o1->zero();
 //std::cout << "Zero():" << o1 << "\n";
 				assert(horizontal_sum(_mm256_loadu_ps(o1->vector)) == 0);
@@ -389,6 +571,26 @@ namespace k_tree
 				}
 		};
 
+	/*
+		CLASS OBJECT_BITS
+		-----------------
+		Hash and compare objects by the bits of their vectors, so that a hash table keyed on objects finds exact duplicates (see
+		context::leaf_with)
+	*/
+	class object_bits
+		{
+		public:
+			size_t operator()(const object *key) const
+				{
+				return std::hash<std::string_view>()(std::string_view((const char *)key->vector, sizeof(*key->vector) * key->dimensions));
+				}
+
+			bool operator()(const object *first, const object *second) const
+				{
+				return memcmp(first->vector, second->vector, sizeof(*first->vector) * first->dimensions) == 0;
+				}
+		};
+
 	/*
 		OPERATOR<<()
 		------------
@@ -0,0 +1,213 @@
+/*
+	STATISTICS.H
+	------------
+	Copyright (c) 2020 Andrew Trotman
+	Released under the 2-clause BSD license (See:https://en.wikipedia.org/wiki/BSD_licenses)
+*/
+#pragma once
+
+#include <stddef.h>
+
+#include <iostream>
+
+/*
+	K_TREE_COUNT()
+	--------------
+	The instrumentation counters are only compiled in when K_TREE_STATS is defined, so wrap each update in this macro
+*/
+#ifdef K_TREE_STATS
+	#define K_TREE_COUNT(statement) statement
+#else
+	#define K_TREE_COUNT(statement)
+#endif
+
+namespace k_tree
+	{
+	/*
+		CLASS STATISTICS
+		----------------
+		Instrumentation counters for the operations on a tree
+	*/
+	class statistics
+		{
+		public:
+			static constexpr size_t max_levels = 64;						// splits are counted by level for levels below this
+
+		public:
+			bool enabled;											// were the counters compiled in (K_TREE_STATS)?
+			size_t inserts;										// the number of calls to push_back()
+			size_t absorbs;										// the number of vectors absorbed into an existing micro-cluster (see node::absorb())
+			size_t duplicates;									// the number of vectors counted into an exact duplicate already in the tree (see context::collapse_duplicates)
+			size_t erases;											// the number of vectors removed with k_tree::erase()
+			size_t updates;										// the number of vectors changed with k_tree::update()
+			size_t relocations;									// the number of those that were taken out and added again
+			size_t tombstones;									// the number of vectors marked as deleted with k_tree::tombstone()
+			size_t compactions;									// the number of subtrees compacted (see k_tree::compact())
+			size_t nodes_visited;								// the number of nodes visited by the inserts
+			size_t max_nodes_visited;							// the most nodes visited by any one insert
+			size_t distance_computations;						// the number of vector distances computed
+			size_t triangle_prunes;								// the number of distances node::closest() did not compute because of the triangle inequality
+			size_t compute_mean_calls;							// the number of calls to node::compute_mean()
+			size_t centroid_refreshes;							// the number of times a node's deferred updates were applied to its centroid (see context::lazy_batch)
+			size_t buffer_flushes;								// the number of times a node's buffer was passed down to its children (see context::buffer_size)
+			size_t splits;											// the number of node splits
+			size_t splits_per_level[max_levels];			// the number of splits at each level (0 is the level directly above the vectors)
+			size_t split_iterations;							// the total number of k-means iterations over all splits
+			size_t max_split_iterations;						// the most k-means iterations in any one split
+			size_t sampled_splits;								// the number of splits that clustered a sample of the children (see context::split_sample)
+			size_t forced_splits;								// the number of splits beyond context::split_budget because a waiting node had no room left
+			size_t splits_capped;								// the number of splits stopped by context::split_max_iterations
+			size_t split_iterations_saved;					// the number of times the bounded k-means skipped a child for a whole iteration (its bounds showed it could not move)
+			size_t split_distances_saved;						// the number of distances the bounded k-means did not need to compute
+			size_t merges;											// the number of nodes that fell below the minimum fill on erase and were merged into a sibling
+			size_t redistributions;								// the number of nodes that fell below the minimum fill on erase and took children from a sibling
+			size_t allocator_bytes;								// the number of bytes allocated by the allocator (filled in by k_tree::stats())
+			size_t allocator_blocks;							// the number of blocks the allocator has taken from the C++ runtime (filled in by k_tree::stats())
+
+		public:
+			/*
+				STATISTICS::STATISTICS()
+				------------------------
+				Constructor
+			*/
+			statistics() :
+#ifdef K_TREE_STATS
+				enabled(true),
+#else
+				enabled(false),
+#endif
+				inserts(0),
+				absorbs(0),
+				duplicates(0),
+				erases(0),
+				updates(0),
+				relocations(0),
+				tombstones(0),
+				compactions(0),
+				nodes_visited(0),
+				max_nodes_visited(0),
+				distance_computations(0),
+				triangle_prunes(0),
+				compute_mean_calls(0),
+				centroid_refreshes(0),
+				buffer_flushes(0),
+				splits(0),
+				splits_per_level(),
+				split_iterations(0),
+				max_split_iterations(0),
+				sampled_splits(0),
+				forced_splits(0),
+				splits_capped(0),
+				split_iterations_saved(0),
+				split_distances_saved(0),
+				merges(0),
+				redistributions(0),
+				allocator_bytes(0),
+				allocator_blocks(0)
+				{
+				/* Nothing */
+				}
+
+			/*
+				STATISTICS::LEVELS()
+				--------------------
+				Return the number of levels that have had a split (that is, the length of the used part of splits_per_level)
+			*/
+			size_t levels(void) const
+				{
+				size_t answer = max_levels;
+				while (answer > 0 && splits_per_level[answer - 1] == 0)
+					answer--;
+				return answer;
+				}
+
+			/*
+				STATISTICS::TEXT_RENDER()
+				-------------------------
+				Serialise the counters in a human-readable format down the given stream
+			*/
+			void text_render(std::ostream &stream) const
+				{
+				if (!enabled)
+					stream << "(tree counters not compiled in, define K_TREE_STATS)\n";
+				stream << "inserts               : " << inserts << "\n";
+				stream << "absorbs               : " << absorbs << "\n";
+				stream << "duplicates            : " << duplicates << "\n";
+				stream << "erases                : " << erases << "\n";
+				stream << "updates               : " << updates << " (" << relocations << " relocated)\n";
+				stream << "tombstones            : " << tombstones << "\n";
+				stream << "compactions           : " << compactions << "\n";
+				stream << "nodes visited         : " << nodes_visited << " (" << (inserts == 0 ? 0.0 : (double)nodes_visited / inserts) << " per insert, max " << max_nodes_visited << ")\n";
+				stream << "distance computations : " << distance_computations << "\n";
+				stream << "triangle prunes       : " << triangle_prunes << "\n";
+				stream << "compute_mean calls    : " << compute_mean_calls << "\n";
+				stream << "centroid refreshes    : " << centroid_refreshes << "\n";
+				stream << "buffer flushes        : " << buffer_flushes << "\n";
+				stream << "splits                : " << splits << "\n";
+				for (size_t level = 0; level < levels(); level++)
+					stream << "  at level " << level << "          : " << splits_per_level[level] << "\n";
+				stream << "k-means iterations    : " << split_iterations << " (" << (splits == 0 ? 0.0 : (double)split_iterations / splits) << " per split, max " << max_split_iterations << ")\n";
+				stream << "sampled splits        : " << sampled_splits << "\n";
+				stream << "forced splits         : " << forced_splits << "\n";
+				stream << "splits capped         : " << splits_capped << "\n";
+				stream << "bounded k-means saves : " << split_iterations_saved << " child iterations (" << split_distances_saved << " distances)\n";
+				stream << "merges                : " << merges << "\n";
+				stream << "redistributions       : " << redistributions << "\n";
+				stream << "allocator bytes       : " << allocator_bytes << "\n";
+				stream << "allocator blocks      : " << allocator_blocks << "\n";
+				}
+
+			/*
+				STATISTICS::JSON_RENDER()
+				-------------------------
+				Serialise the counters as a JSON object down the given stream
+			*/
+			void json_render(std::ostream &stream) const
+				{
+				stream << "{";
+				stream << "\"enabled\":" << (enabled ? "true" : "false");
+				stream << ",\"inserts\":" << inserts;
+				stream << ",\"absorbs\":" << absorbs;
+				stream << ",\"duplicates\":" << duplicates;
+				stream << ",\"erases\":" << erases;
+				stream << ",\"updates\":" << updates;
+				stream << ",\"relocations\":" << relocations;
+				stream << ",\"tombstones\":" << tombstones;
+				stream << ",\"compactions\":" << compactions;
+				stream << ",\"nodes_visited\":" << nodes_visited;
+				stream << ",\"max_nodes_visited\":" << max_nodes_visited;
+				stream << ",\"distance_computations\":" << distance_computations;
+				stream << ",\"triangle_prunes\":" << triangle_prunes;
+				stream << ",\"compute_mean_calls\":" << compute_mean_calls;
+				stream << ",\"centroid_refreshes\":" << centroid_refreshes;
+				stream << ",\"buffer_flushes\":" << buffer_flushes;
+				stream << ",\"splits\":" << splits;
+				stream << ",\"splits_per_level\":[";
+				for (size_t level = 0; level < levels(); level++)
+					stream << (level == 0 ? "" : ",") << splits_per_level[level];
+				stream << "]";
+				stream << ",\"split_iterations\":" << split_iterations;
+				stream << ",\"max_split_iterations\":" << max_split_iterations;
+				stream << ",\"sampled_splits\":" << sampled_splits;
+				stream << ",\"forced_splits\":" << forced_splits;
+				stream << ",\"splits_capped\":" << splits_capped;
+				stream << ",\"split_iterations_saved\":" << split_iterations_saved;
+				stream << ",\"split_distances_saved\":" << split_distances_saved;
+				stream << ",\"merges\":" << merges;
+				stream << ",\"redistributions\":" << redistributions;
+				stream << ",\"allocator_bytes\":" << allocator_bytes;
+				stream << ",\"allocator_blocks\":" << allocator_blocks;
+				stream << "}";
+				}
+		};
+
+	/*
+		OPERATOR<<()
+		------------
+	*/
+	inline std::ostream &operator<<(std::ostream &stream, const statistics &thing)
+		{
+		thing.text_render(stream);
+		return stream;
+		}
+	}
@@ -0,0 +1,297 @@
+/*
+	VECTOR_FILE.CPP
+	---------------
+	Copyright (c) 2020 Andrew Trotman
+	Released under the 2-clause BSD license (See:https://en.wikipedia.org/wiki/BSD_licenses)
+*/
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <iostream>
+
+#include "vector_file.h"
+
+namespace k_tree
+	{
+	/*
+		FILE_LENGTH()
+		-------------
+		Return the length of the open file in bytes, or 0 if it cannot be found
+	*/
+	static size_t file_length(FILE *fp)
+		{
+#ifdef _MSC_VER
+		struct __stat64 details;				// file system's details of the file
+		if (_fstat64(fileno(fp), &details) != 0)
+#else
+		struct stat details;				// file system's details of the file
+		if (fstat(fileno(fp), &details) != 0)
+#endif
+			return 0;				// LCOV_EXCL_LINE	// happens when the file system cannot stat an open file (i.e. disk or file failure).
+
+		return details.st_size;
+		}
+
+	/*
+		ADD_LINE()
+		----------
+		Convert one line of a text file into a vector and append it to into.  The first line with any values on it sets the
+		dimensionality, missing values are zero and extra values are ignored.  Blank lines are skipped.
+	*/
+	static void add_line(const std::string &line, size_t &dimensions, std::vector<float> &into)
+		{
+		/*
+			Count the dimensionality of the first vector (the others should be the same)
+		*/
+		const char *pos = line.c_str();
+		if (dimensions == 0)
+			do
+				{
+				while (isspace(*pos))
+					pos++;
+				if (*pos == '\0')
+					break;
+				dimensions++;
+				while (*pos != '\0' && !isspace(*pos))
+					pos++;
+				}
+			while (*pos != '\0');
+
+		/*
+			Skip blank lines
+		*/
+		pos = line.c_str();
+		while (isspace(*pos))
+			pos++;
+		if (*pos == '\0')
+			return;
+
+		size_t start = into.size();
+		into.resize(start + dimensions);
+		float *vector = &into[start];
+		size_t dimension = 0;
+		do
+			{
+			while (isspace(*pos))
+				pos++;
+			if (*pos == '\0')
+				break;
+			float value = (float)atof(pos);
+			while (*pos != '\0' && !isspace(*pos))
+				pos++;
+			if (dimension < dimensions)
+				vector[dimension] = value;
+			dimension++;
+			}
+		while (*pos != '\0');
+		}
+
+	/*
+		READ_TEXT()
+		-----------
+		Read a file of human-readable vectors, one per line.  The dimensionality is that of the first line.  Returns the dimensionality.
+		The file is read a block at a time and each line converted as soon as it is complete, so only the vectors are ever in memory.
+	*/
+	static size_t read_text(FILE *fp, std::vector<float> &into)
+		{
+		std::vector<char> block(1024 * 1024);
+		std::string line;
+		size_t dimensions = 0;
+		size_t got;
+
+		into.clear();
+		while ((got = fread(block.data(), 1, block.size(), fp)) != 0)
+			{
+			const char *start = block.data();
+			const char *end = start + got;
+			for (const char *pos = start; pos < end; pos++)
+				if (*pos == '\n' || *pos == '\r')
+					{
+					line.append(start, pos);
+					add_line(line, dimensions, into);
+					line.clear();
+					start = pos + 1;
+					}
+			line.append(start, end);
+			}
+		add_line(line, dimensions, into);		// the last line need not end with a newline
+
+		return dimensions;
+		}
+
+	/*
+		READ_BINARY()
+		-------------
+		Read an fvecs file of file_length bytes, one record at a time straight into into.  Returns the dimensionality or 0 if the
+		file is malformed
+	*/
+	static size_t read_binary(FILE *fp, size_t file_length, std::vector<float> &into)
+		{
+		int32_t dimensions;
+		if (fread(&dimensions, sizeof(dimensions), 1, fp) != 1 || dimensions <= 0)
+			return 0;
+
+		size_t record_size = sizeof(int32_t) + sizeof(float) * dimensions;
+		if (file_length % record_size != 0)
+			return 0;
+
+		size_t vectors = file_length / record_size;
+		into.clear();
+		into.resize(vectors * dimensions);
+
+		float *vector = into.data();
+		for (size_t which = 0; which < vectors; which++, vector += dimensions)
+			{
+			int32_t width = dimensions;
+			if (which != 0 && fread(&width, sizeof(width), 1, fp) != 1)
+				return 0;
+			if (width != dimensions || fread(vector, sizeof(float), dimensions, fp) != (size_t)dimensions)
+				return 0;
+			}
+
+		return dimensions;
+		}
+
+	/*
+		VECTOR_FILE::VECTOR_FILE()
+		--------------------------
+		Open the given file for writing vectors of the given dimensionality
+	*/
+	vector_file::vector_file(const std::string &filename, size_t dimensions) :
+		fp(fopen(filename.c_str(), "wb")),
+		type(format_of(filename)),
+		dimensions(dimensions)
+		{
+		/* Nothing */
+		}
+
+	/*
+		VECTOR_FILE::~VECTOR_FILE()
+		---------------------------
+		Destructor
+	*/
+	vector_file::~vector_file()
+		{
+		if (fp != nullptr)
+			fclose(fp);
+		}
+
+	/*
+		VECTOR_FILE::WRITE()
+		--------------------
+		Append a vector (of dimensions floats) to the file.  Returns false on error
+	*/
+	bool vector_file::write(const float *vector)
+		{
+		if (type == BINARY)
+			{
+			int32_t width = (int32_t)dimensions;
+			if (fwrite(&width, sizeof(width), 1, fp) != 1)
+				return false;
+			return fwrite(vector, sizeof(*vector), dimensions, fp) == dimensions;
+			}
+		else
+			{
+			for (size_t dimension = 0; dimension < dimensions; dimension++)
+				if (fprintf(fp, dimension == 0 ? "%.9g" : " %.9g", vector[dimension]) < 0)
+					return false;
+			return fputc('\n', fp) != EOF;
+			}
+		}
+
+	/*
+		VECTOR_FILE::FORMAT_OF()
+		------------------------
+		Return the format of the file based on its name
+	*/
+	vector_file::format vector_file::format_of(const std::string &filename)
+		{
+		static const std::string extension = ".fvecs";
+
+		if (filename.size() >= extension.size() && filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0)
+			return BINARY;
+		return TEXT;
+		}
+
+	/*
+		VECTOR_FILE::READ()
+		-------------------
+		Read the vectors in the given file into into, one after the other.  Returns the dimensionality of the vectors, or 0 on error
+	*/
+	size_t vector_file::read(const std::string &filename, std::vector<float> &into)
+		{
+		FILE *fp;
+		if ((fp = fopen(filename.c_str(), "rb")) == nullptr)
+			return 0;
+
+		size_t dimensions;
+		if (format_of(filename) == BINARY)
+			dimensions = read_binary(fp, file_length(fp), into);
+		else
+			dimensions = read_text(fp, into);
+
+		fclose(fp);
+		return dimensions;
+		}
+
+	/*
+		VECTOR_FILE::UNITTEST()
+		-----------------------
+		Unit test this class
+	*/
+	void vector_file::unittest(void)
+		{
+		const float data[] = {1, -2.5, 3, 0.125, 5, -6e10};
+		std::vector<float> got;
+
+		for (const char *filename : {"vector_file_unittest.txt", "vector_file_unittest.fvecs"})
+			{
+				{
+				vector_file out(filename, 3);
+				assert(out.isopen());
+				out.write(data);
+				out.write(data + 3);
+				}
+
+			assert(read(filename, got) == 3);
+			assert(got.size() == 6);
+			assert(memcmp(&got[0], data, sizeof(data)) == 0);
+			remove(filename);
+			}
+
+		/*
+			Blank lines are skipped, either end of line is accepted, missing values are zero and extra values are ignored
+		*/
+		const char *filename = "vector_file_unittest.txt";
+		FILE *fp = fopen(filename, "wb");
+		fputs("\n1 2 3\r\n\r\n4 5\n6 7 8 9", fp);
+		fclose(fp);
+		const float expected[] = {1, 2, 3, 4, 5, 0, 6, 7, 8};
+		assert(read(filename, got) == 3);
+		assert(got.size() == 9);
+		assert(memcmp(&got[0], expected, sizeof(expected)) == 0);
+		(void)expected;
+		remove(filename);
+
+		/*
+			A truncated fvecs file is malformed
+		*/
+		filename = "vector_file_unittest.fvecs";
+			{
+			vector_file out(filename, 3);
+			out.write(data);
+			}
+		fp = fopen(filename, "ab");
+		fwrite(data, sizeof(float), 1, fp);
+		fclose(fp);
+		assert(read(filename, got) == 0);
+		remove(filename);
+
+		puts("vector_file::PASS");
+		}
+	}
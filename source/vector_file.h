@@ -0,0 +1,95 @@
+/*
+	VECTOR_FILE.H
+	-------------
+	Copyright (c) 2020 Andrew Trotman
+	Released under the 2-clause BSD license (See:https://en.wikipedia.org/wiki/BSD_licenses)
+*/
+#pragma once
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+namespace k_tree
+	{
+	/*
+		CLASS VECTOR_FILE
+		-----------------
+		Reading and writing files of vectors.  Two formats are supported:
+			TEXT:   one vector per line, the values are human-readable and separated by whitespace (as read by build())
+			BINARY: the "fvecs" format, each vector is a little-endian int32 dimensionality followed by that many 32-bit floats
+		The format is chosen from the filename, files ending ".fvecs" are BINARY, all others are TEXT.
+	*/
+	class vector_file
+		{
+		public:
+			/*
+				ENUM VECTOR_FILE::FORMAT
+				------------------------
+			*/
+			enum format
+				{
+				TEXT,
+				BINARY
+				};
+
+		private:
+			FILE *fp;						// the file being written to
+			format type;					// the format of that file
+			size_t dimensions;			// the dimensionality of the vectors in the file
+
+		public:
+			/*
+				VECTOR_FILE::VECTOR_FILE()
+				--------------------------
+				Open the given file for writing vectors of the given dimensionality
+			*/
+			vector_file(const std::string &filename, size_t dimensions);
+
+			/*
+				VECTOR_FILE::~VECTOR_FILE()
+				---------------------------
+				Destructor
+			*/
+			virtual ~vector_file();
+
+			/*
+				VECTOR_FILE::ISOPEN()
+				---------------------
+				Return whether or not the file was opened successfully
+			*/
+			bool isopen(void) const
+				{
+				return fp != nullptr;
+				}
+
+			/*
+				VECTOR_FILE::WRITE()
+				--------------------
+				Append a vector (of dimensions floats) to the file.  Returns false on error
+			*/
+			bool write(const float *vector);
+
+			/*
+				VECTOR_FILE::FORMAT_OF()
+				------------------------
+				Return the format of the file based on its name
+			*/
+			static format format_of(const std::string &filename);
+
+			/*
+				VECTOR_FILE::READ()
+				-------------------
+				Read the vectors in the given file into into, one after the other.  Returns the dimensionality of the vectors, or 0 on error
+			*/
+			static size_t read(const std::string &filename, std::vector<float> &into);
+
+			/*
+				VECTOR_FILE::UNITTEST()
+				-----------------------
+				Unit test this class
+			*/
+			static void unittest(void);
+		};
+	}
@@ -0,0 +1,682 @@
+/*
+	BENCH_K_TREE.CPP
+	----------------
+	Copyright (c) 2020 Andrew Trotman
+	Released under the 2-clause BSD license (See:https://en.wikipedia.org/wiki/BSD_licenses)
+
+	Build a tree, then measure the recall and the throughput of search at several beam widths.  The ground truth is computed by
+	a multi-threaded, cache-blocked, brute-force scan using the object.h kernels.  The data is either read from a file or generated,
+	so this runs entirely offline.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <queue>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <numeric>
+#include <algorithm>
+
+#include "timer.h"
+#include "k_tree.h"
+#include "generator.h"
+#include "vector_file.h"
+
+typedef std::vector<std::pair<float, k_tree::object *>> neighbours;
+
+/*
+	GROUND_TRUTH()
+	--------------
+	Compute the exact k nearest neighbours (closest first) of each query by brute force.  The queries are divided into blocks
+	shared between the threads, and each thread scans the data in blocks small enough to stay in the cache while it is compared to
+	every query in the query block.
+*/
+static void ground_truth(std::vector<neighbours> &truth, const std::vector<k_tree::object *> &data, const std::vector<k_tree::object *> &queries, size_t k, size_t threads)
+	{
+	constexpr size_t query_block = 32;
+	constexpr size_t data_block_bytes = 256 * 1024;
+	size_t data_block = std::max((size_t)1, data_block_bytes / (sizeof(float) * data[0]->dimensions));
+	std::atomic<size_t> next_block(0);
+
+	truth.assign(queries.size(), neighbours());
+
+	auto worker = [&]()
+		{
+		std::vector<std::priority_queue<std::pair<float, k_tree::object *>>> heaps(query_block);
+		size_t block;
+
+		while ((block = next_block++) * query_block < queries.size())
+			{
+			size_t first_query = block * query_block;
+			size_t last_query = std::min(first_query + query_block, queries.size());
+
+			for (size_t data_start = 0; data_start < data.size(); data_start += data_block)
+				{
+				size_t data_end = std::min(data_start + data_block, data.size());
+				for (size_t query = first_query; query < last_query; query++)
+					{
+					auto &heap = heaps[query - first_query];
+					for (size_t which = data_start; which < data_end; which++)
+						{
+						float distance = queries[query]->distance_squared(data[which]);
+						if (heap.size() < k)
+							heap.push(std::make_pair(distance, data[which]));
+						else if (distance < heap.top().first)
+							{
+							heap.pop();
+							heap.push(std::make_pair(distance, data[which]));
+							}
+						}
+					}
+				}
+
+			/*
+				The heaps are largest first, so unload them backwards
+			*/
+			for (size_t query = first_query; query < last_query; query++)
+				{
+				auto &heap = heaps[query - first_query];
+				truth[query].resize(heap.size());
+				for (size_t place = heap.size(); place > 0; place--)
+					{
+					truth[query][place - 1] = heap.top();
+					heap.pop();
+					}
+				}
+			}
+		};
+
+	std::vector<std::thread> pool;
+	for (size_t thread = 1; thread < threads; thread++)
+		pool.push_back(std::thread(worker));
+	worker();
+	for (auto &thread : pool)
+		thread.join();
+	}
+
+/*
+	RECALL()
+	--------
+	Return the proportion of the true k nearest neighbours that were found
+*/
+static double recall(const neighbours &found, const neighbours &truth)
+	{
+	size_t hits = 0;
+
+	for (const auto &expected : truth)
+		for (const auto &got : found)
+			if (got.second == expected.second)
+				{
+				hits++;
+				break;
+				}
+
+	return truth.size() == 0 ? 1.0 : (double)hits / truth.size();
+	}
+
+/*
+	RECALL_TEXT()
+	-------------
+	Return the recall to print in a table, or "-" if it was not measured
+*/
+static std::string recall_text(bool measured, double value)
+	{
+	char text[32];
+
+	if (!measured)
+		return "-";
+	snprintf(text, sizeof(text), "%.4f", value);
+	return text;
+	}
+
+/*
+	LATENCY_RENDER()
+	----------------
+	Print the percentiles of the insert latencies (in nanoseconds) and a histogram with a bucket for each power of two
+*/
+static void latency_render(std::vector<double> &latency)
+	{
+	std::sort(latency.begin(), latency.end());
+	auto percentile = [&latency](double fraction) { return latency[std::min(latency.size() - 1, (size_t)(fraction * latency.size()))] / 1e3; };
+	printf("insert latency (us): p50:%.2f p90:%.2f p99:%.2f p99.9:%.2f p99.99:%.2f max:%.2f\n", percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), percentile(0.9999), latency.back() / 1e3);
+
+	std::vector<size_t> histogram;
+	for (double nanoseconds : latency)
+		{
+		size_t bucket = 0;
+		while ((double)((size_t)2 << bucket) <= nanoseconds)
+			bucket++;
+		if (bucket >= histogram.size())
+			histogram.resize(bucket + 1);
+		histogram[bucket]++;
+		}
+	for (size_t bucket = 0; bucket < histogram.size(); bucket++)
+		if (histogram[bucket] != 0)
+			printf("  < %10zu ns : %zu\n", (size_t)2 << bucket, histogram[bucket]);
+	}
+
+/*
+	TO_OBJECTS()
+	------------
+	Turn a list of raw vectors into a list of objects
+*/
+static void to_objects(std::vector<k_tree::object *> &into, const float *raw, size_t count, k_tree::k_tree &tree, k_tree::allocator &memory)
+	{
+	size_t dimensions = tree.get_example_object()->dimensions;
+
+	for (size_t which = 0; which < count; which++)
+		{
+		k_tree::object *vector = tree.get_example_object()->new_object(&memory);
+		memcpy(vector->vector, raw + which * dimensions, sizeof(float) * dimensions);
+		into.push_back(vector);
+		}
+	}
+
+/*
+	PARSE_LIST()
+	------------
+	Turn a comma separated list of positive numbers into a list.  Returns false if it is not one
+*/
+static bool parse_list(std::vector<size_t> &into, const char *text)
+	{
+	into.clear();
+	for (const char *from = text; ; from++)
+		{
+		char *end;
+		into.push_back(strtoull(from, &end, 10));
+		if (end == from || into.back() == 0)
+			return false;
+		if (*end == '\0')
+			return true;
+		if (*end != ',')
+			return false;
+		from = end;
+		}
+	}
+
+/*
+	USAGE()
+	-------
+*/
+int usage(char *exename)
+	{
+	printf("Usage:%s [options]\n", exename);
+	printf("  -file <vectors>                       read the data from this file (text or .fvecs)\n");
+	printf("  -queries <vectors>                    read the queries from this file (default: the last -query_count data vectors)\n");
+	printf("  -generate <distribution> <count> <dimensions>\n");
+	printf("                                        generate the data (uniform | gaussian | heavy | lowrank, default: gaussian 100000 32)\n");
+	printf("  -seed <n> -clusters <n>               parameters to the generator (default: 1 and 100)\n");
+	printf("  -query_count <n>                      the number of queries (default: 1000)\n");
+	printf("  -order <n>                            the tree order (default: 20)\n");
+	printf("  -leaf_order <n>                       the order of the nodes directly above the vectors (default: the tree order)\n");
+	printf("  -k <n>                                the number of neighbours to find (default: 10)\n");
+	printf("  -beams <n,n,...>                      the beam widths to test (default: 1,2,4,8,16,32,64)\n");
+	printf("  -groups <n,n,...>                     the group sizes to test with interleaved search (default: 1,4,8,16)\n");
+	printf("  -sums                                 keep a running sum at each node rather than updating the mean\n");
+	printf("  -repeat <n>                           vector i of the data occurs max(1, n / (i + 1)) times, a skewed stream (default: 1)\n");
+	printf("  -weighted                             add each distinct vector once, weighted by the times it occurs (see -repeat)\n");
+	printf("  -collapse                             add a vector already in the tree to that leaf's count (see -repeat)\n");
+	printf("  -batch <n>                            insert the vectors n at a time with push_back_batch() (default: 1, push_back())\n");
+	printf("  -split_budget <n>                     split at most n nodes per insert, the rest wait (default: 0, no limit)\n");
+	printf("  -slack <n>                            the children a node may hold beyond its order while it waits (default: the order)\n");
+	printf("  -erase <n>                            after the build, erase the first n vectors then add them back (default: 0)\n");
+	printf("  -update <n>                           after the build, move the first n vectors towards the next vector (default: 0)\n");
+	printf("  -update_step <f>                      the fraction of the way to the next vector to move (default: 0.05)\n");
+	printf("  -window <n>                           after the build, stream the data through a tree holding only the last n vectors\n");
+	printf("  -tombstone                            erase by marking the vectors deleted, compacting subtrees as they fill with them\n");
+	printf("  -dead_fraction <f>                    compact a subtree once this fraction of it is deleted (default: 0.25)\n");
+	printf("  -index                                keep an index of the leaves so that erase does not search for the vector\n");
+	printf("  -absorb <r>                           absorb vectors within this radius of a leaf into it, the leaves become micro-clusters (recall is not measured)\n");
+	printf("  -absorb_budget <n>                    grow the absorb radius to keep at most n micro-clusters (default: 0, no limit)\n");
+	printf("  -min_fill <f>                         on erase, nodes with fewer than this fraction of their order are merged (default: 0.25)\n");
+	printf("  -buffer <n>                           nodes hold up to n vectors before passing them down (default: 0, no buffers)\n");
+	printf("  -lazy <n>                             recompute a node's centroid once every n inserts below it (default: 0, every insert)\n");
+	printf("  -prune                                use the triangle inequality when choosing a child on insert\n");
+	printf("  -split <strategy>                     how to split a node (closest | farthest | kmeans++ | pddp, default: closest)\n");
+	printf("  -ways <n>                             the number of nodes to split a full node into (default: 2)\n");
+	printf("  -bounds                               use Hamerly's bounds in the k-means when splitting a node\n");
+	printf("  -max_iterations <n>                   the most k-means iterations when splitting a node (default: 0, no limit)\n");
+	printf("  -sample <n>                           split a node by clustering a random sample of this many children (default: 0, all)\n");
+	printf("  -threads <n>                          the threads to use for the ground truth (default: one per core)\n");
+	return 1;
+	}
+
+/*
+	MAIN()
+	------
+*/
+int main(int argc, char *argv[])
+	{
+	std::string data_filename;
+	std::string query_filename;
+	k_tree::generator::distribution shape = k_tree::generator::GAUSSIAN_MIXTURE;
+	size_t generate_count = 100'000;
+	size_t dimensions = 32;
+	uint64_t seed = 1;
+	size_t clusters = 100;
+	size_t query_count = 1'000;
+	size_t tree_order = 20;
+	size_t leaf_order = 0;
+	size_t k = 10;
+	std::vector<size_t> beams = {1, 2, 4, 8, 16, 32, 64};
+	std::vector<size_t> groups = {1, 4, 8, 16};
+	size_t threads = std::max(std::thread::hardware_concurrency(), 1U);
+	bool triangle_pruning = false;
+	bool running_sums = false;
+	size_t lazy_batch = 0;
+	size_t insert_batch = 1;
+	size_t buffer_size = 0;
+	size_t split_budget = 0;
+	size_t erase_count = 0;
+	bool index_leaves = false;
+	size_t repeat = 1;
+	bool weighted = false;
+	bool collapse_duplicates = false;
+	bool tombstones = false;
+	size_t update_count = 0;
+	float update_step = 0.05;
+	size_t window_size = 0;
+	float dead_fraction = 0.25;
+	float min_fill = 0.25;
+	float absorb_radius = 0;
+	size_t absorb_budget = 0;
+	size_t overflow_slack = 0;
+	k_tree::context::split_strategy split_method = k_tree::context::CLOSEST_SEEDS;
+	size_t split_ways = 2;
+	bool split_bounds = false;
+	size_t split_max_iterations = 0;
+	size_t split_sample = 0;
+
+	for (int parameter = 1; parameter < argc; parameter++)
+		{
+		bool has_value = parameter + 1 < argc;
+
+		if (strcmp(argv[parameter], "-file") == 0 && has_value)
+			data_filename = argv[++parameter];
+		else if (strcmp(argv[parameter], "-queries") == 0 && has_value)
+			query_filename = argv[++parameter];
+		else if (strcmp(argv[parameter], "-generate") == 0 && parameter + 3 < argc)
+			{
+			if (!k_tree::generator::distribution_of(argv[++parameter], shape))
+				return usage(argv[0]);
+			generate_count = strtoull(argv[++parameter], nullptr, 10);
+			dimensions = strtoull(argv[++parameter], nullptr, 10);
+			}
+		else if (strcmp(argv[parameter], "-seed") == 0 && has_value)
+			seed = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-clusters") == 0 && has_value)
+			clusters = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-query_count") == 0 && has_value)
+			query_count = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-order") == 0 && has_value)
+			tree_order = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-leaf_order") == 0 && has_value)
+			leaf_order = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-k") == 0 && has_value)
+			k = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-prune") == 0)
+			triangle_pruning = true;
+		else if (strcmp(argv[parameter], "-sums") == 0)
+			running_sums = true;
+		else if (strcmp(argv[parameter], "-batch") == 0 && has_value)
+			insert_batch = std::max((size_t)1, (size_t)strtoull(argv[++parameter], nullptr, 10));
+		else if (strcmp(argv[parameter], "-split_budget") == 0 && has_value)
+			split_budget = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-slack") == 0 && has_value)
+			overflow_slack = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-erase") == 0 && has_value)
+			erase_count = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-update") == 0 && has_value)
+			update_count = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-update_step") == 0 && has_value)
+			update_step = strtof(argv[++parameter], nullptr);
+		else if (strcmp(argv[parameter], "-window") == 0 && has_value)
+			window_size = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-tombstone") == 0)
+			tombstones = true;
+		else if (strcmp(argv[parameter], "-dead_fraction") == 0 && has_value)
+			dead_fraction = strtof(argv[++parameter], nullptr);
+		else if (strcmp(argv[parameter], "-index") == 0)
+			index_leaves = true;
+		else if (strcmp(argv[parameter], "-repeat") == 0 && has_value)
+			repeat = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-weighted") == 0)
+			weighted = true;
+		else if (strcmp(argv[parameter], "-collapse") == 0)
+			collapse_duplicates = true;
+		else if (strcmp(argv[parameter], "-min_fill") == 0 && has_value)
+			min_fill = strtof(argv[++parameter], nullptr);
+		else if (strcmp(argv[parameter], "-absorb") == 0 && has_value)
+			absorb_radius = strtof(argv[++parameter], nullptr);
+		else if (strcmp(argv[parameter], "-absorb_budget") == 0 && has_value)
+			absorb_budget = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-buffer") == 0 && has_value)
+			buffer_size = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-lazy") == 0 && has_value)
+			lazy_batch = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-split") == 0 && has_value)
+			{
+			if (!k_tree::context::split_strategy_of(argv[++parameter], split_method))
+				return usage(argv[0]);
+			}
+		else if (strcmp(argv[parameter], "-ways") == 0 && has_value)
+			split_ways = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-bounds") == 0)
+			split_bounds = true;
+		else if (strcmp(argv[parameter], "-max_iterations") == 0 && has_value)
+			split_max_iterations = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-sample") == 0 && has_value)
+			split_sample = strtoull(argv[++parameter], nullptr, 10);
+		else if (strcmp(argv[parameter], "-threads") == 0 && has_value)
+			threads = std::max((size_t)1, (size_t)strtoull(argv[++parameter], nullptr, 10));
+		else if (strcmp(argv[parameter], "-beams") == 0 && has_value)
+			{
+			if (!parse_list(beams, argv[++parameter]))
+				return usage(argv[0]);
+			}
+		else if (strcmp(argv[parameter], "-groups") == 0 && has_value)
+			{
+			if (!parse_list(groups, argv[++parameter]))
+				return usage(argv[0]);
+			}
+		else
+			return usage(argv[0]);
+		}
+
+	if (leaf_order == 0)
+		leaf_order = tree_order;
+	if (split_budget != 0 && overflow_slack == 0)
+		overflow_slack = tree_order;
+	if (tree_order < 2 || leaf_order < 2 || dimensions == 0 || k == 0)
+		return usage(argv[0]);
+
+	/*
+		Get the data and the queries
+	*/
+	std::vector<float> raw_data;
+	std::vector<float> raw_queries;
+	if (data_filename != "")
+		{
+		if ((dimensions = k_tree::vector_file::read(data_filename, raw_data)) == 0)
+			exit(printf("Cannot read vector file: '%s'\n", data_filename.c_str()));
+
+		if (query_filename != "")
+			{
+			if (k_tree::vector_file::read(query_filename, raw_queries) != dimensions)
+				exit(printf("Cannot read query file (or it has the wrong dimensionality): '%s'\n", query_filename.c_str()));
+			}
+		else
+			{
+			/*
+				Hold out the last vectors of the data as the queries
+			*/
+			size_t held_out = std::min(query_count, raw_data.size() / dimensions / 2) * dimensions;
+			raw_queries.assign(raw_data.end() - held_out, raw_data.end());
+			raw_data.resize(raw_data.size() - held_out);
+			}
+		}
+	else
+		{
+		/*
+			The queries come from the same distribution as the data as they are the next vectors from the generator
+		*/
+		k_tree::generator source(shape, dimensions, seed, clusters);
+		raw_data.resize(generate_count * dimensions);
+		for (size_t which = 0; which < generate_count; which++)
+			source.next(&raw_data[which * dimensions]);
+		raw_queries.resize(query_count * dimensions);
+		for (size_t which = 0; which < query_count; which++)
+			source.next(&raw_queries[which * dimensions]);
+		}
+	if (raw_data.empty() || raw_queries.empty())
+		exit(printf("Need at least one data vector and one query\n"));
+
+	k_tree::allocator memory;
+	k_tree::k_tree tree(&memory, leaf_order, tree_order, dimensions);
+	tree.tree_context.triangle_pruning = triangle_pruning;
+	tree.tree_context.running_sums = running_sums;
+	tree.tree_context.lazy_batch = lazy_batch;
+	tree.tree_context.buffer_size = buffer_size;
+	tree.tree_context.split_budget = split_budget;
+	tree.tree_context.overflow_slack = overflow_slack;
+	tree.tree_context.min_fill = min_fill;
+	tree.tree_context.absorb_radius = absorb_radius;
+	tree.tree_context.absorb_budget = absorb_budget;
+	tree.tree_context.index_leaves = index_leaves;
+	tree.tree_context.collapse_duplicates = collapse_duplicates;
+	tree.tree_context.dead_fraction = dead_fraction;
+	tree.tree_context.split_method = split_method;
+	tree.tree_context.split_ways = split_ways;
+	tree.tree_context.split_bounds = split_bounds;
+	tree.tree_context.split_max_iterations = split_max_iterations;
+	tree.tree_context.split_sample = split_sample;
+	k_tree::context settings = tree.tree_context;		// before anything is added, so the window tree starts with the same configuration
+	std::vector<k_tree::object *> data;
+	std::vector<k_tree::object *> queries;
+	to_objects(data, raw_data.data(), raw_data.size() / dimensions, tree, memory);
+	to_objects(queries, raw_queries.data(), raw_queries.size() / dimensions, tree, memory);
+
+	/*
+		The stream to add to the tree: each vector as many times as it occurs, or once with that weight
+	*/
+	std::vector<k_tree::object *> stream;
+	std::vector<size_t> occurs(data.size());
+	for (size_t which = 0; which < data.size(); which++)
+		{
+		occurs[which] = std::max(repeat / (which + 1), (size_t)1);
+		stream.insert(stream.end(), weighted ? 1 : occurs[which], data[which]);
+		}
+
+	printf("data:%zu queries:%zu dimensions:%zu order:%zu leaf order:%zu k:%zu\n", data.size(), queries.size(), dimensions, tree_order, leaf_order, k);
+	if (repeat > 1)
+		printf("stream:%zu vectors (%zu inserts)\n", std::accumulate(occurs.begin(), occurs.end(), (size_t)0), stream.size());
+
+	/*
+		Build the tree
+	*/
+	std::vector<double> latency;
+	size_t bytes_before_build = memory.bytes_used();
+	timer::stopwatch clock = timer::start();
+	if (weighted)
+		{
+		latency.reserve(stream.size());
+		for (size_t which = 0; which < stream.size(); which++)
+			{
+			timer::stopwatch insert_clock = timer::start();
+			tree.push_back_weighted(&memory, stream[which], occurs[which]);
+			latency.push_back(timer::stop(insert_clock));
+			}
+		}
+	else if (insert_batch == 1)
+		{
+		latency.reserve(stream.size());
+		for (const auto vector : stream)
+			{
+			timer::stopwatch insert_clock = timer::start();
+			tree.push_back(&memory, vector);
+			latency.push_back(timer::stop(insert_clock));
+			}
+		}
+	else
+		for (size_t start = 0; start < stream.size(); start += insert_batch)
+			tree.push_back_batch(&memory, &stream[start], std::min(insert_batch, stream.size() - start));
+	tree.finish_splits(&memory);
+	tree.refresh_centroids();
+	double build_ns = timer::stop(clock);
+	printf("build: %.3f seconds (%.0f inserts/second)\n", build_ns / 1e9, stream.size() / (build_ns / 1e9));
+	if (absorb_radius != 0)
+		printf("micro-clusters: %zu (radius %f) tree memory: %zu bytes\n", tree.tree_context.micro_clusters, tree.tree_context.absorb_radius, memory.bytes_used() - bytes_before_build);
+	if (collapse_duplicates)
+		printf("leaves: %zu duplicates collapsed: %zu tree memory: %zu bytes\n", tree.tree_context.leaf_with.size(), stream.size() - tree.tree_context.leaf_with.size(), memory.bytes_used() - bytes_before_build);
+	else if (repeat > 1)
+		printf("tree memory: %zu bytes\n", memory.bytes_used() - bytes_before_build);
+	if (latency.size() != 0)
+		latency_render(latency);
+
+	/*
+		Erase some of the vectors and put them back (so the tree holds the same data for the searches)
+	*/
+	if (erase_count != 0)
+		{
+		erase_count = std::min(erase_count, data.size());
+		clock = timer::start();
+		for (size_t which = 0; which < erase_count; which++)
+			if (tombstones)
+				tree.tombstone(&memory, data[which]);
+			else
+				tree.erase(&memory, data[which]);
+		double erase_ns = timer::stop(clock);
+		printf("erase: %.3f seconds (%.0f erases/second)\n", erase_ns / 1e9, erase_count / (erase_ns / 1e9));
+
+		clock = timer::start();
+		tree.compact(&memory);
+		tree.refresh_centroids();
+		double compact_ns = timer::stop(clock);
+		printf("compact: %.3f seconds\n", compact_ns / 1e9);
+
+		for (size_t which = 0; which < erase_count; which++)
+			tree.push_back(&memory, data[which]);
+		tree.finish_splits(&memory);
+		tree.refresh_centroids();
+		}
+
+	/*
+		Move some of the vectors a little
+	*/
+	if (update_count != 0)
+		{
+		std::vector<k_tree::object *> moved;
+		update_count = std::min(update_count, data.size() - 1);
+		for (size_t which = 0; which < update_count; which++)
+			{
+			moved.push_back(tree.get_example_object()->new_object(&memory));
+			*moved.back() = *data[which];
+			moved.back()->fused_multiply_add(*data[which + 1], update_step);
+			moved.back()->fused_multiply_add(*data[which], -update_step);
+			}
+
+		clock = timer::start();
+		for (size_t which = 0; which < update_count; which++)
+			tree.update(&memory, data[which], moved[which]);
+		tree.finish_splits(&memory);
+		tree.refresh_centroids();
+		double update_ns = timer::stop(clock);
+		printf("update: %.3f seconds (%.0f updates/second)\n", update_ns / 1e9, update_count / (update_ns / 1e9));
+		}
+
+	/*
+		Stream the data through a sliding window, the timestamp is the vector's position in the data and a tenth of the window
+		expires at a time.  The copies of the vectors are reused once they expire so the memory used should stop growing.  The
+		window tree has the same configuration as the tree above, but micro-clusters do not keep the vectors that expire() removes
+	*/
+	if (window_size != 0 && absorb_radius != 0)
+		printf("window: not run, micro-clusters (-absorb) cannot expire vectors\n");
+	else if (window_size != 0)
+		{
+		k_tree::allocator window_memory(1'048'576);
+		k_tree::k_tree stream(&window_memory, leaf_order, tree_order, dimensions);
+		stream.tree_context = settings;
+		stream.tree_context.index_leaves = true;
+		std::vector<k_tree::object *> spare;
+		size_t step = std::max(window_size / 10, (size_t)1);
+		size_t expired = 0;
+		size_t bytes_at_half = 0;
+
+		clock = timer::start();
+		for (size_t which = 0; which < data.size(); which++)
+			{
+			k_tree::object *copy;
+			if (spare.empty())
+				copy = stream.get_example_object()->new_object(&window_memory);
+			else
+				{
+				copy = spare.back();
+				spare.pop_back();
+				}
+			*copy = *data[which];
+			stream.push_back(&window_memory, copy, which);
+			if ((which + 1) % step == 0 && which + 1 > window_size)
+				expired += stream.expire(&window_memory, which + 1 - window_size, &spare);
+			if (which == data.size() / 2)
+				bytes_at_half = window_memory.bytes_used();
+			}
+		double window_ns = timer::stop(clock);
+		printf("window: %.3f seconds (%.0f inserts/second, %zu expired) memory: %zu bytes at half way, %zu at the end\n", window_ns / 1e9, data.size() / (window_ns / 1e9), expired, bytes_at_half, window_memory.bytes_used());
+		}
+	k_tree::statistics counters = tree.stats();
+	if (counters.enabled)
+		std::cout << counters << "(the timings include the cost of keeping these counters, bench_k_tree does not keep them)\n";
+	else
+		printf("allocator: %zu bytes in %zu blocks (bench_k_tree_stats reports the operation counters)\n", counters.allocator_bytes, counters.allocator_blocks);
+
+	/*
+		The quality of the clustering
+	*/
+	k_tree::analysis quality = tree.analyse(threads);
+	double max_drift = 0;
+	for (const auto &level : quality.levels)
+		max_drift = std::max(max_drift, level.max_drift);
+	printf("depth:%zu leaf fill:%.3f distortion:%g sum squared error:%g max centroid drift:%g\n", quality.depth, quality.leaf_fill_factor(), quality.distortion(), quality.sum_squared_error(), max_drift);
+
+	/*
+		Compute the ground truth.  Micro-clusters do not record which vectors they absorbed, so search finds centroids that cannot
+		be matched to the true neighbours and only the throughput is measured
+	*/
+	std::vector<neighbours> truth;
+	bool score = absorb_radius == 0;
+	if (score)
+		{
+		clock = timer::start();
+		ground_truth(truth, data, queries, k, threads);
+		double truth_ns = timer::stop(clock);
+		printf("brute force: %.3f seconds (%.0f queries/second on %zu threads)\n", truth_ns / 1e9, queries.size() / (truth_ns / 1e9), threads);
+		}
+	else
+		printf("recall: not measured, the leaves are micro-clusters (-absorb) not the vectors\n");
+
+	/*
+		Search at each beam width
+	*/
+	printf("%10s %10s %14s %14s\n", "beam", "recall@k", "queries/second", "us/query");
+	neighbours found;
+	for (size_t beam : beams)
+		{
+		double total_recall = 0;
+		double search_ns = 0;
+
+		for (size_t query = 0; query < queries.size(); query++)
+			{
+			clock = timer::start();
+			tree.search(found, queries[query], k, beam);
+			search_ns += timer::stop(clock);
+			if (score)
+				total_recall += recall(found, truth[query]);
+			}
+
+		printf("%10zu %10s %14.0f %14.2f\n", beam, recall_text(score, total_recall / queries.size()).c_str(), queries.size() / (search_ns / 1e9), search_ns / 1e3 / queries.size());
+		}
+
+	/*
+		Interleaved search (a beam width of 1) with each group size
+	*/
+	printf("%10s %10s %14s %14s\n", "group", "recall@k", "queries/second", "us/query");
+	std::vector<neighbours> found_batch;
+	for (size_t group : groups)
+		{
+		double total_recall = 0;
+
+		clock = timer::start();
+		tree.search_batch(found_batch, &queries[0], queries.size(), k, group);
+		double search_ns = timer::stop(clock);
+		for (size_t query = 0; query < queries.size() && score; query++)
+			total_recall += recall(found_batch[query], truth[query]);
+
+		printf("%10zu %10s %14.0f %14.2f\n", group, recall_text(score, total_recall / queries.size()).c_str(), queries.size() / (search_ns / 1e9), search_ns / 1e3 / queries.size());
+		}
+
+	return 0;
+	}
@@ -0,0 +1,192 @@
+/*
+	BENCH_OBJECT.CPP
+	----------------
+	Copyright (c) 2020 Andrew Trotman
+	Released under the 2-clause BSD license (See:https://en.wikipedia.org/wiki/BSD_licenses)
+
+	Microbenchmark each of the vector kernels in object.h.  The kernels choose between AVX2 and AVX-512 at compile time, so this
+	program is built twice: bench_object (using the native instruction set) and bench_object_avx2 (with AVX-512 turned off).  The
+	scalar comparison is object::distance_squared_linear().
+
+	Each kernel is timed on pairs of vectors drawn from a pool that is either small enough to stay in the L1 cache (showing the
+	compute cost) or much larger than the last level cache (showing the memory cost), with the vectors either 64-byte aligned or
+	deliberately misaligned by one float.  The bandwidth figure counts the bytes the kernel reads and writes.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <limits>
+
+
+#include "timer.h"
+#include "object.h"
+#include "allocator.h"
+
+/*
+	ROUND_UP()
+	----------
+	Round value up to the nearest multiple of to
+*/
+static size_t round_up(size_t value, size_t to)
+	{
+	return (value + to - 1) / to * to;
+	}
+
+/*
+	CLASS BENCHMARK
+	---------------
+	The pool of vectors and the settings for one measurement
+*/
+class benchmark
+	{
+	public:
+		k_tree::object *a;				// the first parameter to the kernel (its vector is pointed into the pool)
+		k_tree::object *b;				// the second parameter to the kernel (its vector is pointed into the pool)
+		float *pool;						// the vectors
+		size_t pairs;						// the number of (a, b) pairs in the pool
+		size_t stride;						// the distance (in floats) from one vector to the next in the pool
+		size_t offset;						// the misalignment (in floats) of each vector
+		size_t dimensions;				// the dimensionality of the vectors
+		size_t width;						// the number of floats the SIMD kernels actually touch
+		double minimum_ns;				// the minimum time to run each kernel for
+		const char *pool_name;			// "cache" or "memory"
+		double sink;						// the results of the kernels are summed here so that the compiler cannot remove them
+
+	public:
+		/*
+			BENCHMARK::MEASURE()
+			--------------------
+			Time the kernel over the pool of vector pairs until at least minimum_ns have passed then print the results.  simd is
+			whether the kernel processes the padded width or only the dimensions, vectors_touched is the number of vectors read or
+			written per call (to compute the bandwidth)
+		*/
+		template <typename KERNEL>
+		void measure(const char *name, bool simd, size_t vectors_touched, KERNEL kernel)
+			{
+			size_t calls = 0;
+			double elapsed = 0;
+			timer::stopwatch clock = timer::start();
+
+			do
+				{
+				for (size_t pair = 0; pair < pairs; pair++)
+					{
+					a->vector = pool + (2 * pair) * stride + offset;
+					b->vector = pool + (2 * pair + 1) * stride + offset;
+					sink += kernel(a, b);
+					}
+				calls += pairs;
+				elapsed = timer::stop(clock);
+				}
+			while (elapsed < minimum_ns);
+
+			double ns = elapsed / calls;
+			double bytes = sizeof(float) * (simd ? width : dimensions) * vectors_touched;
+			printf("%-24s %10zu %-9s %-6s %12.2f %10.2f\n", name, dimensions, offset == 0 ? "aligned" : "unaligned", pool_name, ns, bytes / ns);
+			fflush(stdout);
+			}
+	};
+
+/*
+	USAGE()
+	-------
+*/
+int usage(char *exename)
+	{
+	printf("Usage:%s [-time <ms_per_measurement>] [-cache <bytes>] [-memory <bytes>]\n", exename);
+	return 1;
+	}
+
+/*
+	MAIN()
+	------
+*/
+int main(int argc, char *argv[])
+	{
+	size_t cache_pool_bytes = 16 * 1024;
+	size_t memory_pool_bytes = 256 * 1024 * 1024;
+	const size_t dimension_list[] = {2, 8, 16, 32, 64, 100, 128, 256, 512, 1024, 4096};
+	benchmark bench;
+
+	bench.minimum_ns = 20'000'000;
+	bench.sink = 0;
+	for (int parameter = 1; parameter < argc; parameter += 2)
+		{
+		if (parameter + 1 >= argc)
+			return usage(argv[0]);
+		else if (strcmp(argv[parameter], "-time") == 0)
+			bench.minimum_ns = atof(argv[parameter + 1]) * 1'000'000;
+		else if (strcmp(argv[parameter], "-cache") == 0)
+			cache_pool_bytes = strtoull(argv[parameter + 1], nullptr, 10);
+		else if (strcmp(argv[parameter], "-memory") == 0)
+			memory_pool_bytes = strtoull(argv[parameter + 1], nullptr, 10);
+		else
+			return usage(argv[0]);
+		}
+
+	#ifdef __AVX512F__
+		puts("Using AVX-512");
+	#else
+		puts("Using AVX2");
+	#endif
+
+	printf("%-24s %10s %-9s %-6s %12s %10s\n", "kernel", "dimensions", "alignment", "pool", "ns/op", "GB/s");
+
+	for (size_t dimensions : dimension_list)
+		{
+		/*
+			Get two objects of the right dimensionality, the benchmark points their vectors into the pool
+		*/
+		k_tree::allocator memory(1024 * 1024);
+		k_tree::object *example = k_tree::object::new_example(&memory, dimensions);
+		bench.a = example->new_object(&memory);
+		bench.b = example->new_object(&memory);
+
+		#ifdef __AVX512F__
+			bench.width = round_up(dimensions, 16);
+		#else
+			bench.width = round_up(dimensions, 8);
+		#endif
+		bench.dimensions = dimensions;
+		bench.stride = round_up(bench.width + 1, 16);				// room for each vector to be misaligned by one float
+
+		for (size_t pool_bytes : {cache_pool_bytes, memory_pool_bytes})
+			{
+			bench.pool_name = pool_bytes == cache_pool_bytes ? "cache" : "memory";
+			bench.pairs = pool_bytes / (2 * sizeof(float) * bench.stride);
+			if (bench.pairs == 0)
+				bench.pairs = 1;
+
+			bench.pool = (float *)aligned_alloc(64, round_up(sizeof(float) * bench.stride * 2 * bench.pairs, 64));
+			for (size_t which = 0; which < 2 * bench.pairs; which++)
+				for (size_t element = 0; element < bench.stride; element++)
+					bench.pool[which * bench.stride + element] = which % 2 == 0 ? 1.0f : 0.001f;
+
+			for (size_t offset : {0, 1})
+				{
+				bench.offset = offset;
+				bench.measure("distance_squared", true, 2, [](k_tree::object *a, k_tree::object *b) { return a->distance_squared(b); });
+				bench.measure("distance_squared(limit)", true, 2, [](k_tree::object *a, k_tree::object *b) { return a->distance_squared(b, std::numeric_limits<float>::max()); });
+				bench.measure("distance_squared_linear", false, 2, [](k_tree::object *a, k_tree::object *b) { return a->distance_squared_linear(b); });
+				bench.measure("distance_l1", true, 2, [](k_tree::object *a, k_tree::object *b) { return a->distance_l1(b); });
+				bench.measure("operator=", true, 2, [](k_tree::object *a, k_tree::object *b) { *a = *b; return a->vector[0]; });
+				bench.measure("operator+=", true, 3, [](k_tree::object *a, k_tree::object *b) { *a += *b; return a->vector[0]; });
+				bench.measure("operator/=", true, 2, [](k_tree::object *a, k_tree::object *b) { *a /= 1.0f; return a->vector[0]; });
+				bench.measure("fused_multiply_add", true, 3, [](k_tree::object *a, k_tree::object *b) { a->fused_multiply_add(*b, 1.0f); return a->vector[0]; });
+				bench.measure("fused_subtract_divide", true, 3, [](k_tree::object *a, k_tree::object *b) { a->fused_subtract_divide(*b, 2.0f); return a->vector[0]; });
+				bench.measure("absorb", true, 3, [](k_tree::object *a, k_tree::object *b) { a->absorb(*b, 1.0f, 0.5f); return a->vector[0]; });
+				bench.measure("zero", false, 1, [](k_tree::object *a, k_tree::object *b) { a->zero(); return a->vector[0]; });
+				}
+
+			free(bench.pool);
+			}
+		}
+
+	/*
+		Use the results so that the compiler cannot remove the work
+	*/
+	fprintf(stderr, "(checksum %g)\n", bench.sink);
+
+	return 0;
+	}
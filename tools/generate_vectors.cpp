@@ -0,0 +1,85 @@
+/*
+	GENERATE_VECTORS.CPP
+	--------------------
+	Copyright (c) 2020 Andrew Trotman
+	Released under the 2-clause BSD license (See:https://en.wikipedia.org/wiki/BSD_licenses)
+
+	Generate a reproducible synthetic dataset for benchmarking.  The vectors are streamed to disk one at a time so the size of the
+	dataset is limited only by the disk.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+#include <iostream>
+
+#include "generator.h"
+#include "vector_file.h"
+
+/*
+	USAGE()
+	-------
+*/
+int usage(char *exename)
+	{
+	std::cout << "Usage:" << exename << " <uniform | gaussian | heavy | lowrank> <count> <dimensions> <outfile> [-seed <n>] [-clusters <n>] [-spread <f>] [-skew <f>] [-rank <n>]\n";
+	std::cout << "       outfile is binary (fvecs) if its name ends in .fvecs, otherwise it is text (as read by k_tree_example build)\n";
+	return 1;
+	}
+
+/*
+	MAIN()
+	------
+*/
+int main(int argc, char *argv[])
+	{
+	k_tree::generator::distribution shape;
+	uint64_t seed = 1;
+	size_t clusters = 16;
+	float spread = 0.05;
+	double skew = 1.1;
+	size_t rank = 8;
+
+	if (argc < 5 || (argc - 5) % 2 != 0)
+		return usage(argv[0]);
+
+	if (!k_tree::generator::distribution_of(argv[1], shape))
+		return usage(argv[0]);
+
+	size_t count = strtoull(argv[2], nullptr, 10);
+	size_t dimensions = strtoull(argv[3], nullptr, 10);
+	if (dimensions == 0)
+		exit(printf("Dimensions must be at least 1\n"));
+
+	for (int parameter = 5; parameter < argc; parameter += 2)
+		{
+		if (strcmp(argv[parameter], "-seed") == 0)
+			seed = strtoull(argv[parameter + 1], nullptr, 10);
+		else if (strcmp(argv[parameter], "-clusters") == 0)
+			clusters = strtoull(argv[parameter + 1], nullptr, 10);
+		else if (strcmp(argv[parameter], "-spread") == 0)
+			spread = (float)atof(argv[parameter + 1]);
+		else if (strcmp(argv[parameter], "-skew") == 0)
+			skew = atof(argv[parameter + 1]);
+		else if (strcmp(argv[parameter], "-rank") == 0)
+			rank = strtoull(argv[parameter + 1], nullptr, 10);
+		else
+			return usage(argv[0]);
+		}
+
+	k_tree::generator source(shape, dimensions, seed, clusters, spread, skew, rank);
+	k_tree::vector_file outfile(argv[4], dimensions);
+	if (!outfile.isopen())
+		exit(printf("Cannot open output file: '%s'\n", argv[4]));
+
+	std::vector<float> vector(dimensions);
+	for (size_t which = 0; which < count; which++)
+		{
+		source.next(vector.data());
+		if (!outfile.write(vector.data()))
+			exit(printf("Cannot write to output file: '%s'\n", argv[4]));
+		}
+
+	return 0;
+	}
@@ -0,0 +1,34 @@
+/*
+	TIMER.H
+	-------
+	Copyright (c) 2020 Andrew Trotman
+	Released under the 2-clause BSD license (See:https://en.wikipedia.org/wiki/BSD_licenses)
+*/
+#pragma once
+
+#include <chrono>
+
+namespace timer
+	{
+	typedef std::chrono::steady_clock::time_point stopwatch;
+
+	/*
+		TIMER::START()
+		--------------
+		Start timing
+	*/
+	inline stopwatch start(void)
+		{
+		return std::chrono::steady_clock::now();
+		}
+
+	/*
+		TIMER::STOP()
+		-------------
+		Return the number of nanoseconds since the stopwatch was started
+	*/
+	inline double stop(const stopwatch &started)
+		{
+		return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count();
+		}
+	}